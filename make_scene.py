@@ -134,6 +134,18 @@ class Scene:
         self.primitives.append(box)
         return idx
 
+    def add_mesh(self, file: str, material: int, args: dict | None = None):
+        mesh = {
+            "type": "mesh",
+            "file": file,
+            "material": material,
+        }
+        if args is not None:
+            mesh.update(args)
+        idx = len(self.primitives)
+        self.primitives.append(mesh)
+        return idx
+
     def write_json(self, path):
         with open(path, "w") as json_file:
             json.dump(
@@ -226,6 +238,16 @@ def make_constant_medium(density, albedo: list):
     return {"constant_medium": {"density": density, "albedo": albedo}}
 
 
+def make_noise_medium(density, albedo: list, scale, resolution: list = [64, 64, 64]):
+    return {
+        "heterogeneous_medium": {
+            "density": density,
+            "albedo": albedo,
+            "noise": {"scale": scale, "resolution": resolution},
+        }
+    }
+
+
 def make_transform(
     translation: list | None = None,
     rotation: list | None = None,
@@ -5,8 +5,11 @@
 #include <imgui.h>
 
 #include <cstddef>
+#include <ctime>
 #include <filesystem>
+#include <iomanip>
 #include <memory>
+#include <nlohmann/json.hpp>
 
 #include "Paths.hpp"
 #include "Serialize.hpp"
@@ -63,6 +66,38 @@ class Quad {
 std::unique_ptr<gl::Texture> output_tex;
 glm::ivec2 viewport_dims;
 
+double SecondsSince(uint64_t start_counter) {
+  return static_cast<double>(SDL_GetPerformanceCounter() - start_counter) /
+         static_cast<double>(SDL_GetPerformanceFrequency());
+}
+
+// Predicts how long the next pass takes from the time per rendered tile of the passes so far,
+// since passes get cheaper as adaptive sampling retires tiles. Keeps running averages of the
+// time and of its deviation like a round trip time estimator, and predicts a couple of
+// deviations above the average so a slow pass rarely overruns.
+class PassTimeModel {
+ public:
+  void AddPass(double seconds, size_t num_tiles) {
+    double per_tile = seconds / static_cast<double>(std::max<size_t>(num_tiles, 1));
+    if (num_passes_++ == 0) {
+      mean_ = per_tile;
+      deviation_ = per_tile / 4;
+    } else {
+      deviation_ += kGain * (std::abs(per_tile - mean_) - deviation_);
+      mean_ += kGain * (per_tile - mean_);
+    }
+  }
+  [[nodiscard]] double Predict(size_t num_tiles) const {
+    return (mean_ + 2 * deviation_) * static_cast<double>(num_tiles);
+  }
+
+ private:
+  static constexpr double kGain = 0.125;
+  size_t num_passes_{0};
+  double mean_{0};
+  double deviation_{0};
+};
+
 }  // namespace
 
 void App::OnResize(glm::ivec2 dims) {
@@ -79,6 +114,7 @@ void App::OnResize(glm::ivec2 dims) {
 }
 
 void App::Run(int argc, char* argv[]) {
+  uint64_t run_start = SDL_GetPerformanceCounter();
   settings_ = serialize::LoadAppSettings(GET_PATH("local/data/settings.json"));
 
   std::string full_scene_path;
@@ -109,11 +145,29 @@ void App::Run(int argc, char* argv[]) {
   std::cout << "Render once: " << settings_.render_once << '\n';
   std::cout << "Num Samples: " << settings_.num_samples << '\n';
   std::cout << "Max Depth: " << settings_.max_depth << '\n';
+  std::cout << "Russian Roulette Min Depth: " << settings_.russian_roulette_min_depth << '\n';
+  const char* light_sampling_names[] = {"bsdf", "nee", "mis", "restir"};
+  std::cout << "Light Sampling: "
+            << light_sampling_names[static_cast<int>(settings_.light_sampling)] << '\n';
   std::cout << "Save Output: " << settings_.save_after_render_once << '\n';
+  std::cout << "Tile Size: " << settings_.tile_size << '\n';
+  std::cout << "Seed: " << settings_.seed << '\n';
+  const char* sampler_names[] = {"independent", "stratified", "sobol", "zsobol"};
+  std::cout << "Sampler: " << sampler_names[static_cast<int>(settings_.sampler)] << '\n';
+  std::cout << "Adaptive Threshold: " << settings_.adaptive_threshold << '\n';
+  std::cout << "Adaptive Min Samples: " << settings_.adaptive_min_samples << '\n';
+  std::cout << "Time Budget Seconds: " << settings_.time_budget_seconds << '\n';
+  if (settings_.deadline.has_value()) {
+    std::cout << "Deadline: " << std::put_time(std::localtime(&settings_.deadline.value()), "%c")
+              << '\n';
+  }
+  std::cout << "BVH Split Method: "
+            << (settings_.bvh_build.split_method == cpu::BVHSplitMethod::kSAH ? "sah" : "median")
+            << '\n';
   std::cout << "Scene Path: " << full_scene_path << '\n';
 
   glm::ivec2 initial_dims{1600, 900};
-  serialize::SceneLoader loader;
+  serialize::SceneLoader loader{settings_.bvh_build};
   auto scene_opt = loader.LoadScene(full_scene_path);
   if (!scene_opt.has_value()) {
     exit(1);
@@ -123,9 +177,26 @@ void App::Run(int argc, char* argv[]) {
     initial_dims = scene.dims;
     scene.cam.SetDims(scene.dims);
   }
-  scene.hittable_list = cpu::HittableList{std::make_shared<cpu::BVHNode>(scene.hittable_list)};
+  uint64_t bvh_build_start = SDL_GetPerformanceCounter();
+  auto bvh = cpu::BuildSceneBVH(scene.hittable_list, settings_.bvh_build);
+  double bvh_build_ms = 1000.0 * (SDL_GetPerformanceCounter() - bvh_build_start) /
+                        static_cast<double>(SDL_GetPerformanceFrequency());
+  std::cout << "BVH Build Time: " << bvh_build_ms << " ms\n";
+  std::cout << "BVH Nodes: " << bvh->NumNodes() << '\n';
+  std::cout << "BVH Wide Nodes: " << bvh->NumWideNodes() << '\n';
+  std::cout << "BVH Primitives: " << bvh->NumPrimitives() << '\n';
+  std::cout << "BVH SAH Cost: " << bvh->SAHCost() << '\n';
+  std::cout << "Sampled Lights: " << scene.lights.size() << '\n';
+  scene.hittable_list = cpu::HittableList{bvh};
   // TODO: streamline
   cpu_tracer_.max_depth = settings_.max_depth;
+  cpu_tracer_.russian_roulette_min_depth = settings_.russian_roulette_min_depth;
+  cpu_tracer_.light_sampling = settings_.light_sampling;
+  cpu_tracer_.tile_size = settings_.tile_size;
+  cpu_tracer_.seed = settings_.seed;
+  cpu_tracer_.sampler_type = settings_.sampler;
+  cpu_tracer_.adaptive_threshold = settings_.adaptive_threshold;
+  cpu_tracer_.adaptive_min_samples = settings_.adaptive_min_samples;
   scene.cam.SetSamplesPerPixel(settings_.num_samples);
   cpu_tracer_.camera = &scene.cam;
 
@@ -171,6 +242,14 @@ void App::Run(int argc, char* argv[]) {
     std::cout << "Writing image: " << image_output_path << '\n';
     util::WriteImage(cpu_tracer_.NonConvertedPixels(), cpu_tracer_.Dims().x, cpu_tracer_.Dims().y,
                      image_output_path);
+    // what the image ended up costing, next to it
+    nlohmann::json stats;
+    stats["passes"] = cpu_tracer_.FrameIdx();
+    stats["mean_samples_per_pixel"] = cpu_tracer_.MeanSamplesPerPixel();
+    stats["converged"] = cpu_tracer_.Converged();
+    stats["seconds"] = SecondsSince(run_start);
+    util::WriteJson(stats,
+                    std::filesystem::path(image_output_path).replace_extension(".json").string());
   };
 
   if (settings_.render_window) {
@@ -193,7 +272,7 @@ void App::Run(int argc, char* argv[]) {
         window_->PollEvents();
       }
 
-      bool done = (cpu_tracer_.FrameIdx() > settings_.num_samples);
+      bool done = (cpu_tracer_.FrameIdx() > settings_.num_samples) || cpu_tracer_.Converged();
       if (!done || !settings_.render_once) {
         cpu_tracer_.Update(scene);
       } else {
@@ -218,7 +297,7 @@ void App::Run(int argc, char* argv[]) {
       ImGui::Text("Target: %i", static_cast<int>(settings_.num_samples));
       ImGui::SameLine();
       if (ImGui::Button("Load Scene")) {
-        serialize::SceneLoader loader;
+        serialize::SceneLoader loader{settings_.bvh_build};
         auto scene_opt = loader.LoadScene(GET_PATH("local/data/") + std::string(scene_name));
         if (scene_opt.has_value()) {
           scene = scene_opt.value();
@@ -241,9 +320,34 @@ void App::Run(int argc, char* argv[]) {
       window_->EndRenderFrame(imgui_enabled_);
     }
   } else {
-    for (size_t i = 0; i < settings_.num_samples; i++) {
-      cpu_tracer_.Update(scene);
+    // seconds since the start of the run the image has to be written by, if limited
+    std::optional<double> time_limit;
+    if (settings_.time_budget_seconds > 0) time_limit = settings_.time_budget_seconds;
+    if (settings_.deadline.has_value()) {
+      double until_deadline =
+          std::difftime(settings_.deadline.value(), std::time(nullptr)) + SecondsSince(run_start);
+      time_limit = std::min(time_limit.value_or(until_deadline), until_deadline);
+    }
+    if (time_limit.has_value()) {
+      // refine for as long as the next pass is predicted to fit, but always render one
+      PassTimeModel pass_time_model;
+      while (!cpu_tracer_.Converged()) {
+        size_t num_tiles = cpu_tracer_.NumActiveTiles();
+        if (cpu_tracer_.FrameIdx() > 0 &&
+            SecondsSince(run_start) + pass_time_model.Predict(num_tiles) > time_limit.value()) {
+          break;
+        }
+        uint64_t pass_start = SDL_GetPerformanceCounter();
+        cpu_tracer_.Update(scene);
+        pass_time_model.AddPass(SecondsSince(pass_start), num_tiles);
+      }
+    } else {
+      for (size_t i = 0; i < settings_.num_samples && !cpu_tracer_.Converged(); i++) {
+        cpu_tracer_.Update(scene);
+      }
     }
+    std::cout << "Passes: " << cpu_tracer_.FrameIdx()
+              << ", Mean Samples Per Pixel: " << cpu_tracer_.MeanSamplesPerPixel() << '\n';
     write_image();
   }
 }
@@ -0,0 +1,239 @@
+#include "ObjLoader.hpp"
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#include <atomic>
+#include <charconv>
+#include <fstream>
+
+#include "cpu_raytrace/Triangle.hpp"
+
+namespace raytrace2::serialize {
+
+namespace {
+
+// the file is split at line ends into chunks of about this many bytes, parsed as separate tasks
+constexpr size_t kChunkSize = size_t{1} << 20;
+
+enum Attribute { kPosition, kUV, kNormal, kNumAttributes };
+constexpr int32_t kMissing = INT32_MIN;
+
+// Indices of one face corner, kMissing where an attribute is left out. Positive OBJ indices
+// count from the start of the file and are stored 0 based. Negative ones count back from the
+// last attribute read, which a chunk only knows relative to its own first attribute, so they
+// are stored relative to that and flagged until the chunk offsets are known.
+struct ObjCorner {
+  int32_t index[kNumAttributes];
+  uint8_t chunk_relative;  // bit per attribute
+};
+
+struct ObjChunk {
+  std::vector<vec3> attributes[kNumAttributes];  // uvs keep only x and y
+  std::vector<ObjCorner> corners;                // three per triangle
+  bool all_uvs{true};
+  bool all_normals{true};
+  size_t num_bad_lines{0};
+};
+
+bool IsSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+const char* SkipSpaces(const char* p, const char* end) {
+  while (p < end && IsSpace(*p)) p++;
+  return p;
+}
+
+bool ParseReal(const char*& p, const char* end, real& value) {
+  p = SkipSpaces(p, end);
+  auto [ptr, ec] = std::from_chars(p, end, value);
+  if (ec != std::errc{}) return false;
+  p = ptr;
+  return true;
+}
+
+bool ParseIndex(const char*& p, const char* end, int32_t& index) {
+  auto [ptr, ec] = std::from_chars(p, end, index);
+  if (ec != std::errc{} || index == 0) return false;
+  p = ptr;
+  return true;
+}
+
+// reads position[/uv][/normal], position//normal leaves out the uv
+bool ParseCorner(const char*& p, const char* end, const ObjChunk& chunk, ObjCorner& corner) {
+  int32_t raw[kNumAttributes] = {0, 0, 0};
+  if (!ParseIndex(p, end, raw[kPosition])) return false;
+  for (int attribute = kUV; attribute < kNumAttributes && p < end && *p == '/'; attribute++) {
+    p++;
+    if (p < end && *p != '/' && !IsSpace(*p) && !ParseIndex(p, end, raw[attribute])) {
+      return false;
+    }
+  }
+  corner.chunk_relative = 0;
+  for (int attribute = 0; attribute < kNumAttributes; attribute++) {
+    if (raw[attribute] > 0) {
+      corner.index[attribute] = raw[attribute] - 1;
+    } else if (raw[attribute] < 0) {
+      corner.index[attribute] =
+          static_cast<int32_t>(chunk.attributes[attribute].size()) + raw[attribute];
+      corner.chunk_relative |= 1 << attribute;
+    } else {
+      corner.index[attribute] = kMissing;
+    }
+  }
+  return true;
+}
+
+void ParseChunk(std::string_view text, ObjChunk& chunk) {
+  std::vector<ObjCorner> polygon;
+  const char* p = text.data();
+  const char* end = text.data() + text.size();
+  while (p < end) {
+    const auto* line_end = static_cast<const char*>(std::memchr(p, '\n', end - p));
+    if (line_end == nullptr) line_end = end;
+    p = SkipSpaces(p, line_end);
+    const char* keyword_end = p;
+    while (keyword_end < line_end && !IsSpace(*keyword_end)) keyword_end++;
+    std::string_view keyword{p, static_cast<size_t>(keyword_end - p)};
+    p = keyword_end;
+
+    bool ok = true;
+    if (keyword == "v" || keyword == "vn") {
+      vec3 v{0};
+      ok = ParseReal(p, line_end, v.x) && ParseReal(p, line_end, v.y) &&
+           ParseReal(p, line_end, v.z);
+      chunk.attributes[keyword == "v" ? kPosition : kNormal].emplace_back(v);
+    } else if (keyword == "vt") {
+      // the v coordinate is optional
+      vec3 uv{0};
+      ok = ParseReal(p, line_end, uv.x);
+      ParseReal(p, line_end, uv.y);
+      chunk.attributes[kUV].emplace_back(uv);
+    } else if (keyword == "f") {
+      polygon.clear();
+      for (p = SkipSpaces(p, line_end); p < line_end && ok; p = SkipSpaces(p, line_end)) {
+        ObjCorner corner;
+        ok = ParseCorner(p, line_end, chunk, corner);
+        if (!ok) break;
+        chunk.all_uvs &= corner.index[kUV] != kMissing;
+        chunk.all_normals &= corner.index[kNormal] != kMissing;
+        polygon.emplace_back(corner);
+      }
+      ok &= polygon.size() >= 3;
+      for (size_t i = 1; ok && i + 1 < polygon.size(); i++) {
+        chunk.corners.insert(chunk.corners.end(), {polygon[0], polygon[i], polygon[i + 1]});
+      }
+    }
+    chunk.num_bad_lines += !ok;
+    p = line_end + 1;
+  }
+}
+
+}  // namespace
+
+std::shared_ptr<cpu::MeshData> LoadOBJ(const std::string& filepath) {
+  std::ifstream file(filepath, std::ios::binary | std::ios::ate);
+  if (!file.is_open()) {
+    std::cerr << "Failed to open obj file: " << filepath << '\n';
+    return nullptr;
+  }
+  std::string text(static_cast<size_t>(file.tellg()), '\0');
+  file.seekg(0);
+  file.read(text.data(), static_cast<std::streamsize>(text.size()));
+
+  std::vector<std::string_view> chunk_texts;
+  for (size_t begin = 0; begin < text.size();) {
+    size_t end = text.find('\n', std::min(begin + kChunkSize, text.size()));
+    end = end == std::string::npos ? text.size() : end + 1;
+    chunk_texts.emplace_back(text.data() + begin, end - begin);
+    begin = end;
+  }
+  std::vector<ObjChunk> chunks(chunk_texts.size());
+  tbb::parallel_for(size_t{0}, chunks.size(),
+                    [&](size_t i) { ParseChunk(chunk_texts[i], chunks[i]); });
+
+  // where each chunk's attributes and corners start in the whole file
+  struct Offsets {
+    size_t attributes[kNumAttributes]{};
+    size_t corners{0};
+  };
+  std::vector<Offsets> offsets(chunks.size() + 1);
+  bool all_uvs = true, all_normals = true;
+  size_t num_bad_lines = 0;
+  for (size_t i = 0; i < chunks.size(); i++) {
+    for (int attribute = 0; attribute < kNumAttributes; attribute++) {
+      offsets[i + 1].attributes[attribute] =
+          offsets[i].attributes[attribute] + chunks[i].attributes[attribute].size();
+    }
+    offsets[i + 1].corners = offsets[i].corners + chunks[i].corners.size();
+    all_uvs &= chunks[i].all_uvs;
+    all_normals &= chunks[i].all_normals;
+    num_bad_lines += chunks[i].num_bad_lines;
+  }
+  const Offsets& totals = offsets.back();
+  if (num_bad_lines > 0) {
+    std::cerr << "Skipped " << num_bad_lines << " malformed lines of obj file: " << filepath
+              << '\n';
+  }
+  if (totals.corners > 3 * static_cast<size_t>(UINT32_MAX / 3) ||
+      totals.attributes[kPosition] > UINT32_MAX) {
+    std::cerr << "Too many triangles in obj file: " << filepath << '\n';
+    return nullptr;
+  }
+  all_uvs &= totals.attributes[kUV] > 0;
+  all_normals &= totals.attributes[kNormal] > 0;
+
+  auto data = std::make_shared<cpu::MeshData>();
+  data->positions.resize(totals.attributes[kPosition]);
+  data->indices.resize(totals.corners);
+  if (all_uvs) {
+    data->uvs.resize(totals.attributes[kUV]);
+    data->uv_indices.resize(totals.corners);
+  }
+  if (all_normals) {
+    data->normals.resize(totals.attributes[kNormal]);
+    data->normal_indices.resize(totals.corners);
+  }
+  std::vector<uint32_t>* attribute_indices[kNumAttributes] = {
+      &data->indices, all_uvs ? &data->uv_indices : nullptr,
+      all_normals ? &data->normal_indices : nullptr};
+
+  std::atomic<bool> out_of_range{false};
+  tbb::parallel_for(size_t{0}, chunks.size(), [&](size_t i) {
+    ObjChunk& chunk = chunks[i];
+    const Offsets& offset = offsets[i];
+    std::copy(chunk.attributes[kPosition].begin(), chunk.attributes[kPosition].end(),
+              data->positions.begin() + offset.attributes[kPosition]);
+    if (all_uvs) {
+      std::transform(chunk.attributes[kUV].begin(), chunk.attributes[kUV].end(),
+                     data->uvs.begin() + offset.attributes[kUV],
+                     [](const vec3& uv) { return vec2{uv}; });
+    }
+    if (all_normals) {
+      std::copy(chunk.attributes[kNormal].begin(), chunk.attributes[kNormal].end(),
+                data->normals.begin() + offset.attributes[kNormal]);
+    }
+    for (size_t c = 0; c < chunk.corners.size(); c++) {
+      const ObjCorner& corner = chunk.corners[c];
+      for (int attribute = 0; attribute < kNumAttributes; attribute++) {
+        if (attribute_indices[attribute] == nullptr) continue;
+        auto index = static_cast<int64_t>(corner.index[attribute]);
+        if (corner.chunk_relative & (1 << attribute)) {
+          index += static_cast<int64_t>(offset.attributes[attribute]);
+        }
+        if (index < 0 || index >= static_cast<int64_t>(totals.attributes[attribute])) {
+          out_of_range.store(true, std::memory_order_relaxed);
+          index = 0;
+        }
+        (*attribute_indices[attribute])[offset.corners + c] = static_cast<uint32_t>(index);
+      }
+    }
+    chunk = {};
+  });
+  if (out_of_range.load()) {
+    std::cerr << "Face index out of range in obj file: " << filepath << '\n';
+    return nullptr;
+  }
+  return data;
+}
+
+}  // namespace raytrace2::serialize
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "Defs.hpp"
+
+namespace raytrace2::cpu {
+struct MeshData;
+}
+
+namespace raytrace2::serialize {
+
+// Reads the vertices and faces of an OBJ file, parsing chunks of it in parallel. Polygons are
+// split into fans of triangles. Materials, groups and other statements are ignored, and normals
+// or uvs are dropped unless every face corner has them. nullptr if the file can't be read or a
+// face indexes past the vertices.
+std::shared_ptr<cpu::MeshData> LoadOBJ(const std::string& filepath);
+
+}  // namespace raytrace2::serialize
@@ -1,20 +1,27 @@
 #include "Serialize.hpp"
 
+#include <ctime>
+#include <filesystem>
+#include <iomanip>
 #include <limits>
 #include <memory>
 #include <nlohmann/json.hpp>
 
 #include "Defs.hpp"
+#include "ObjLoader.hpp"
 #include "Paths.hpp"
 #include "Settings.hpp"
 #include "Util.hpp"
 #include "cpu_raytrace/BVH.hpp"
+#include "cpu_raytrace/Box.hpp"
 #include "cpu_raytrace/Camera.hpp"
 #include "cpu_raytrace/ConstantMedium.hpp"
 #include "cpu_raytrace/Fwd.hpp"
+#include "cpu_raytrace/HeterogeneousMedium.hpp"
 #include "cpu_raytrace/Hittable.hpp"
 #include "cpu_raytrace/HittableList.hpp"
 #include "cpu_raytrace/Material.hpp"
+#include "cpu_raytrace/Mesh.hpp"
 #include "cpu_raytrace/Quad.hpp"
 #include "cpu_raytrace/Scene.hpp"
 #include "cpu_raytrace/Sphere.hpp"
@@ -27,6 +34,39 @@ namespace {
 vec3 ToVec3(const std::array<real, 3>& arr) { return {arr[0], arr[1], arr[2]}; }
 vec4 ToVec4(const std::array<real, 4>& arr) { return {arr[0], arr[1], arr[2], arr[3]}; }
 std::array<real, 3> ToVec3Arr(const vec3& vec) { return {vec[0], vec[1], vec[2]}; }
+
+// gathers the world space spheres and quads with a diffuse light material, returns false if an
+// emitter is found that can't be sampled, such as one under an instance transform or a mesh
+bool CollectLights(const std::shared_ptr<cpu::Hittable>& obj,
+                   const std::vector<cpu::MaterialVariant>& materials,
+                   std::vector<std::shared_ptr<cpu::Hittable>>& lights, bool instanced = false) {
+  auto is_emissive = [&materials](uint32_t material_handle) {
+    return std::holds_alternative<cpu::DiffuseLight>(materials[material_handle]);
+  };
+  uint32_t material_handle;
+  if (const auto* sphere = dynamic_cast<const cpu::Sphere*>(obj.get())) {
+    material_handle = sphere->material_handle;
+  } else if (const auto* quad = dynamic_cast<const cpu::Quad*>(obj.get())) {
+    material_handle = quad->material_handle;
+  } else if (const auto* mesh = dynamic_cast<const cpu::TriangleMesh*>(obj.get())) {
+    return !is_emissive(mesh->material_handle);
+  } else if (const auto* list = dynamic_cast<const cpu::HittableList*>(obj.get())) {
+    bool all_sampled = true;
+    for (const auto& child : list->objects) {
+      all_sampled &= CollectLights(child, materials, lights, instanced);
+    }
+    return all_sampled;
+  } else if (const auto* instance = dynamic_cast<const cpu::TransformedHittable*>(obj.get())) {
+    return CollectLights(instance->obj, materials, lights, true);
+  } else {
+    return true;
+  }
+  if (!is_emissive(material_handle)) return true;
+  if (instanced) return false;
+  lights.emplace_back(obj);
+  return true;
+}
+
 }  // namespace
 
 cpu::Camera LoadCamera(const nlohmann::json& obj) {
@@ -60,7 +100,61 @@ AppSettings LoadAppSettings(const std::string& filepath) {
   settings.render_once = obj.value("render_once", false);
   settings.save_after_render_once = obj.value("save_after_render_once", false);
   settings.max_depth = obj.value("max_depth", 50);
+  settings.russian_roulette_min_depth = obj.value("russian_roulette_min_depth", 3);
+  std::string light_sampling = obj.value("light_sampling", "mis");
+  settings.light_sampling = cpu::LightSampling::kMIS;
+  if (light_sampling == "bsdf") {
+    settings.light_sampling = cpu::LightSampling::kBSDF;
+  } else if (light_sampling == "nee") {
+    settings.light_sampling = cpu::LightSampling::kNEE;
+  } else if (light_sampling == "restir") {
+    settings.light_sampling = cpu::LightSampling::kReSTIR;
+  } else if (light_sampling != "mis") {
+    std::cerr << "Invalid light_sampling: " << light_sampling << ", using mis\n";
+  }
   settings.render_window = obj.value("render_window", true);
+  settings.tile_size = obj.value("tile_size", 16);
+  if (settings.tile_size <= 0) {
+    std::cerr << "Invalid tile_size: " << settings.tile_size << ", using 16\n";
+    settings.tile_size = 16;
+  }
+  settings.seed = obj.value("seed", 0u);
+  std::string sampler = obj.value("sampler", "sobol");
+  settings.sampler = cpu::SamplerType::kSobol;
+  if (sampler == "independent") {
+    settings.sampler = cpu::SamplerType::kIndependent;
+  } else if (sampler == "stratified") {
+    settings.sampler = cpu::SamplerType::kStratified;
+  } else if (sampler == "zsobol") {
+    settings.sampler = cpu::SamplerType::kZSobol;
+  } else if (sampler != "sobol") {
+    std::cerr << "Invalid sampler: " << sampler << ", using sobol\n";
+  }
+  settings.adaptive_threshold = obj.value("adaptive_threshold", 0.0f);
+  settings.adaptive_min_samples = obj.value("adaptive_min_samples", 64u);
+  settings.time_budget_seconds = obj.value("time_budget_seconds", 0.0);
+  if (obj.contains("deadline")) {
+    // local time
+    std::string deadline = obj.value("deadline", "");
+    std::tm tm{};
+    std::istringstream stream(deadline);
+    stream >> std::get_time(&tm, "%Y-%m-%dT%H:%M:%S");
+    if (stream.fail()) {
+      std::cerr << "Invalid deadline: " << deadline << ", expected YYYY-MM-DDTHH:MM:SS\n";
+    } else {
+      tm.tm_isdst = -1;
+      settings.deadline = std::mktime(&tm);
+    }
+  }
+  std::string split_method = obj.value("bvh_split_method", "sah");
+  if (split_method == "median") {
+    settings.bvh_build.split_method = cpu::BVHSplitMethod::kMedian;
+  } else if (split_method != "sah") {
+    std::cerr << "Invalid bvh_split_method: " << split_method << ", using sah\n";
+  }
+  settings.bvh_build.max_leaf_size = obj.value("bvh_max_leaf_size", 4);
+  settings.bvh_build.num_bins = obj.value("bvh_num_bins", 16);
+  settings.bvh_build.width = obj.value("bvh_width", 4);
   return settings;
 }
 
@@ -131,36 +225,15 @@ std::optional<mat4> SceneLoader::ParseTransform(const nlohmann::json& node) cons
   return std::nullopt;
 }
 mat4 SceneLoader::AccumulateTransform(const mat4& transform, const nlohmann::json& node) const {
-  if (node.contains("transform")) {
-    const auto& transform_json = node["transform"];
-    if (transform_json.is_object()) {
-      vec3 translation{0};
-      if (transform_json.contains("translation")) {
-        translation = ToVec3(transform_json.value("translation", std::array<real, 3>{0, 0, 0}));
-      }
-      quat rotation;
-      if (transform_json.contains("rotation")) {
-        vec4 angle_axis =
-            ToVec4(transform_json.value("rotation", std::array<real, 4>({0, 0, 1, 0})));
-        rotation = glm::angleAxis(glm::radians(angle_axis[0]),
-                                  vec3{angle_axis[1], angle_axis[2], angle_axis[3]});
-      }
-      vec3 scale{1};
-      if (transform_json.contains("scale")) {
-        scale = ToVec3(transform_json.value("scale", std::array<real, 3>({1, 1, 1})));
-      }
-      return glm::translate(mat4(1), translation) * glm::toMat4(rotation) *
-             glm::scale(mat4(1), scale) * transform;
-    }
-    // TODO: make accessible here for better usability
-    // print_scene_error("transform key must be an object");
-  }
-  return transform;
+  auto local = ParseTransform(node);
+  return local.has_value() ? transform * local.value() : transform;
 }
 
 std::shared_ptr<cpu::Hittable> SceneLoader::ParseNode(
-    std::vector<std::shared_ptr<cpu::Hittable>>& list, const nlohmann::json& node) const {
+    std::vector<std::shared_ptr<cpu::Hittable>>& list, const nlohmann::json& node,
+    const mat4& parent_transform) const {
   std::shared_ptr<cpu::Hittable> return_obj{nullptr};
+  mat4 transform = AccumulateTransform(parent_transform, node);
   if (node.contains("primitive")) {
     int primitive_idx = node.value("primitive", -1);
     if (primitive_idx == -1) {
@@ -169,19 +242,31 @@ std::shared_ptr<cpu::Hittable> SceneLoader::ParseNode(
     if (primitive_idx >= static_cast<int>(list.size())) {
       PrintSceneError("primitive out of range of primitives");
     }
-    return_obj = list[primitive_idx];
+    const auto& primitive = list[primitive_idx];
+    if (transform == mat4(1)) {
+      return_obj = primitive;
+    } else {
+      // lists referenced from several nodes stay instances of one shared copy, everything else
+      // is baked into world space so rays skip the matrix work
+      bool shared = primitive_ref_counts_[primitive_idx] > 1 &&
+                    dynamic_cast<const cpu::HittableList*>(primitive.get()) != nullptr;
+      if (!shared) return_obj = primitive->BakeTransform(transform);
+      if (!return_obj) {
+        return_obj = std::make_shared<cpu::TransformedHittable>(primitive, transform);
+      }
+    }
   }
 
-  auto transform = ParseTransform(node);
   if (node.contains("children")) {
     const auto& children = node["children"];
     if (!children.is_array()) {
       PrintSceneError("children entry must be an array");
     } else {
+      // children inherit the accumulated transform, so the group itself needs none
       auto children_list = std::make_shared<cpu::HittableList>();
       if (return_obj) children_list->Add(return_obj);
       for (const auto& child : children) {
-        children_list->Add(ParseNode(list, child));
+        children_list->Add(ParseNode(list, child, transform));
       }
       return_obj = children_list;
     }
@@ -189,13 +274,19 @@ std::shared_ptr<cpu::Hittable> SceneLoader::ParseNode(
   if (return_obj == nullptr) {
     PrintSceneError("error parsing node");
   }
-  if (transform.has_value()) {
-    // TODO: refactor parse transform
-    return std::make_shared<cpu::TransformedHittable>(return_obj, transform.value());
-  }
   return return_obj;
 };
 
+void SceneLoader::CountPrimitiveRefs(const nlohmann::json& node) {
+  int primitive_idx = node.value("primitive", -1);
+  if (primitive_idx >= 0 && primitive_idx < static_cast<int>(primitive_ref_counts_.size())) {
+    primitive_ref_counts_[primitive_idx]++;
+  }
+  if (node.contains("children") && node["children"].is_array()) {
+    for (const auto& child : node["children"]) CountPrimitiveRefs(child);
+  }
+}
+
 std::optional<cpu::Scene> SceneLoader::LoadScene(const std::string& filepath) {
   filepath_ = filepath;
   cpu::Scene scene;
@@ -229,6 +320,7 @@ std::optional<cpu::Scene> SceneLoader::LoadScene(const std::string& filepath) {
             .noise =
                 cpu::PerlinNoiseGen{
                     json_mat.value("point_count", 256),
+                    json_mat.value("seed", static_cast<uint32_t>(scene.textures.size())),
                 },
             .albedo = ToVec3(json_mat.value("albedo", std::array<real, 3>{1, 1, 1})),
             .scale = json_mat.value("scale", 1.0f),
@@ -300,9 +392,26 @@ std::optional<cpu::Scene> SceneLoader::LoadScene(const std::string& filepath) {
     } else if (type == "box") {
       auto a = ToVec3(primitive.value("a", std::array<real, 3>{0, 0, 0}));
       auto b = ToVec3(primitive.value("b", std::array<real, 3>{1, 1, 1}));
-      hittable =
-          std::make_shared<cpu::HittableList>(cpu::MakeBox(a, b, primitive.value("material", 0)));
+      uint32_t material = primitive.value("material", 0);
+      // emissive boxes stay six quads, which can be sampled as lights
+      if (material < scene.materials.size() &&
+          std::holds_alternative<cpu::DiffuseLight>(scene.materials[material])) {
+        hittable = std::make_shared<cpu::HittableList>(cpu::MakeBox(a, b, material));
+      } else {
+        hittable = std::make_shared<cpu::Box>(a, b, material);
+      }
 
+    } else if (type == "mesh") {
+      // relative to the scene file
+      std::filesystem::path file = primitive.value("file", "");
+      if (file.is_relative()) file = std::filesystem::path(filepath_).parent_path() / file;
+      auto data = LoadOBJ(file.string());
+      if (!data) {
+        PrintSceneError("failed to load mesh " + file.string());
+        continue;
+      }
+      hittable = std::make_shared<cpu::TriangleMesh>(std::move(data),
+                                                     primitive.value("material", 0), bvh_build_);
     } else if (type == "sphere") {
       std::array<real, 3> center = primitive.value("center", std::array<real, 3>{0, 0, 0});
       std::array<real, 3> displacement =
@@ -317,33 +426,102 @@ std::optional<cpu::Scene> SceneLoader::LoadScene(const std::string& filepath) {
       continue;
     }
 
-    // parse constant medium
-    if (primitive.contains("constant_medium")) {
-      const auto& const_med_json = primitive["constant_medium"];
-      uint32_t material_idx;
-      if (const_med_json.contains("albedo")) {
+    // media take the material of their albedo or a material index, false if there is neither
+    auto parse_medium_material = [&](const nlohmann::json& med_json, uint32_t& material_idx) {
+      if (med_json.contains("albedo")) {
         // make texture material
         auto mat = cpu::MaterialIsotropic{.tex_idx = static_cast<uint32_t>(scene.textures.size())};
         // make color texture at the tex idx
         scene.textures.emplace_back(cpu::texture::SolidColor{
-            .albedo = ToVec3(const_med_json.value("albedo", std::array<real, 3>({0, 0, 0})))});
+            .albedo = ToVec3(med_json.value("albedo", std::array<real, 3>({0, 0, 0})))});
         material_idx = scene.materials.size();
         scene.materials.emplace_back(mat);
-      } else if (const_med_json.contains("material")) {
-        material_idx = const_med_json.value("material", 0);
+      } else if (med_json.contains("material")) {
+        material_idx = med_json.value("material", 0);
       } else {
+        return false;
+      }
+      return true;
+    };
+
+    // parse constant medium
+    if (primitive.contains("constant_medium")) {
+      const auto& const_med_json = primitive["constant_medium"];
+      uint32_t material_idx;
+      if (!parse_medium_material(const_med_json, material_idx)) {
         PrintSceneError("constant_medium must contain 'albedo' or 'material'");
         continue;
       }
       real density = const_med_json.value("density", 0.01);
       hittable = std::make_shared<cpu::ConstantMedium>(hittable, density, material_idx);
+    } else if (primitive.contains("heterogeneous_medium")) {
+      const auto& het_med_json = primitive["heterogeneous_medium"];
+      uint32_t material_idx;
+      if (!parse_medium_material(het_med_json, material_idx)) {
+        PrintSceneError("heterogeneous_medium must contain 'albedo' or 'material'");
+        continue;
+      }
+      if (!hittable->IsConvex()) {
+        PrintSceneError("heterogeneous_medium needs a sphere or non-emissive box boundary");
+        continue;
+      }
+      // the grid spans the bounds of the boundary
+      cpu::DensityGrid grid;
+      if (het_med_json.contains("grid")) {
+        const auto& grid_json = het_med_json["grid"];
+        auto resolution = grid_json.value("resolution", std::array<int, 3>{2, 2, 2});
+        auto values = grid_json.value("values", std::vector<real>{});
+        glm::ivec3 res{resolution[0], resolution[1], resolution[2]};
+        if (res.x < 2 || res.y < 2 || res.z < 2 ||
+            values.size() != static_cast<size_t>(res.x) * res.y * res.z) {
+          PrintSceneError("heterogeneous_medium grid needs at least 2 vertices per axis and a "
+                          "value for each");
+          continue;
+        }
+        grid = cpu::DensityGrid{res, std::move(values), hittable->GetAABB()};
+      } else if (het_med_json.contains("noise")) {
+        const auto& noise_json = het_med_json["noise"];
+        auto resolution = noise_json.value("resolution", std::array<int, 3>{64, 64, 64});
+        glm::ivec3 res = glm::max(glm::ivec3{resolution[0], resolution[1], resolution[2]},
+                                  glm::ivec3{2});
+        cpu::PerlinNoiseGen noise{noise_json.value("point_count", 256),
+                                  noise_json.value("seed", 0u)};
+        grid = cpu::DensityGrid::FromNoise(noise, noise_json.value("scale", 1.0f), res,
+                                           hittable->GetAABB());
+      } else {
+        PrintSceneError("heterogeneous_medium must contain 'grid' or 'noise'");
+        continue;
+      }
+      hittable = std::make_shared<cpu::HeterogeneousMedium>(
+          hittable, std::move(grid), het_med_json.value("density", 1.0f), material_idx);
     }
     list.emplace_back(hittable);
   }
 
+  primitive_ref_counts_.assign(list.size(), 0);
+  for (const auto& node_json : obj["scene"]) CountPrimitiveRefs(node_json);
   for (const auto& node_json : obj["scene"]) {
-    scene.hittable_list.Add(ParseNode(list, node_json));
+    scene.hittable_list.Add(ParseNode(list, node_json, mat4(1)));
+  }
+  bool all_lights_sampled = true;
+  for (const auto& obj : scene.hittable_list.objects) {
+    all_lights_sampled &= CollectLights(obj, scene.materials, scene.lights);
+  }
+  if (!all_lights_sampled) {
+    // sampling only some of the emitters would drop the light of the rest
+    std::cerr << "Scene has instanced or mesh emitters, direct light sampling is disabled. "
+              << filepath_ << '\n';
+    scene.lights.clear();
+  }
+  // the BVH tests copies of spheres and quads, which carry the index along to their hits
+  for (uint32_t i = 0; i < scene.lights.size(); i++) {
+    if (auto* sphere = dynamic_cast<cpu::Sphere*>(scene.lights[i].get())) {
+      sphere->light_idx = i;
+    } else if (auto* quad = dynamic_cast<cpu::Quad*>(scene.lights[i].get())) {
+      quad->light_idx = i;
+    }
   }
+  scene.light_bvh = cpu::LightBVH{scene.lights, scene};
 
   // TODO: move to camera?
   if (obj["camera"].is_object()) {
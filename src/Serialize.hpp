@@ -3,6 +3,7 @@
 #include <nlohmann/json_fwd.hpp>
 
 #include "Defs.hpp"
+#include "cpu_raytrace/BVH.hpp"
 
 namespace raytrace2 {
 namespace cpu {
@@ -19,13 +20,21 @@ struct Transform;
 namespace raytrace2::serialize {
 
 struct SceneLoader {
+  // bvh_build is used for the BVHs meshes build over their triangles
+  explicit SceneLoader(const cpu::BVHBuildSettings& bvh_build = {}) : bvh_build_(bvh_build) {}
   [[nodiscard]] std::optional<cpu::Scene> LoadScene(const std::string& filepath);
 
  private:
   std::string filepath_;
+  cpu::BVHBuildSettings bvh_build_;
+  // number of scene nodes referencing each primitive
+  std::vector<uint32_t> primitive_ref_counts_;
   void PrintSceneError(const std::string& msg) const;
+  // transforms are accumulated down the graph and baked into the primitives at the leaves
   std::shared_ptr<cpu::Hittable> ParseNode(std::vector<std::shared_ptr<cpu::Hittable>>& list,
-                                           const nlohmann::json& node) const;
+                                           const nlohmann::json& node,
+                                           const mat4& parent_transform) const;
+  void CountPrimitiveRefs(const nlohmann::json& node);
   [[nodiscard]] std::optional<mat4> ParseTransform(const nlohmann::json& node) const;
   [[nodiscard]] mat4 AccumulateTransform(const mat4& transform, const nlohmann::json& node) const;
 };
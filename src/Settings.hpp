@@ -1,5 +1,10 @@
 #pragma once
 
+#include <ctime>
+
+#include "cpu_raytrace/BVH.hpp"
+#include "cpu_raytrace/RayTracer.hpp"
+
 namespace raytrace2 {
 
 struct AppSettings {
@@ -7,6 +12,18 @@ struct AppSettings {
   bool save_after_render_once;
   size_t num_samples;
   size_t max_depth;
+  size_t russian_roulette_min_depth;
+  cpu::LightSampling light_sampling;
   bool render_window;
+  int tile_size;
+  uint32_t seed;
+  cpu::SamplerType sampler;
+  real adaptive_threshold;
+  uint32_t adaptive_min_samples;
+  // headless renders past num_samples until whichever of these comes first, 0 and none for
+  // no limit
+  double time_budget_seconds;
+  std::optional<std::time_t> deadline;
+  cpu::BVHBuildSettings bvh_build;
 };
 }  // namespace raytrace2
@@ -31,19 +31,43 @@ class AABB {
   [[nodiscard]] vec3 GetMin() const { return vec3{x.min, y.min, z.min}; }
   [[nodiscard]] vec3 GetMax() const { return vec3{x.max, y.max, z.max}; }
 
-  [[nodiscard]] bool Hit(const Ray& r, Interval ray_t) const {
-    for (int axis = 0; axis < 3; axis++) {
-      const Interval& ax = AxisInterval(axis);
-      const real ad_inv = 1.f / r.direction[axis];
-      auto t0 = (ax.min - r.origin[axis]) * ad_inv;
-      auto t1 = (ax.max - r.origin[axis]) * ad_inv;
+  [[nodiscard]] bool Hit(const Ray& r, Interval ray_t) const { return Hit(TraversalRay{r}, ray_t); }
 
-      if (t1 < t0) std::swap(t0, t1);
-      ray_t.min = glm::max(t0, ray_t.min);
-      ray_t.max = glm::min(t1, ray_t.max);
-      if (ray_t.max <= ray_t.min) return false;
+  // Slab test against the near and far planes picked by the direction signs. Distances to a
+  // plane the ray lies in are NaN, and std::max/min return their first argument when comparing
+  // against a NaN, so such planes leave the ray interval untouched. Flat boxes whose padding
+  // rounds away on large coordinates still count as hit.
+  [[nodiscard]] bool Hit(const TraversalRay& r, Interval ray_t) const {
+    real t_near_x = ((r.dir_is_neg[0] ? x.max : x.min) - r.origin.x) * r.inv_dir.x;
+    real t_far_x = ((r.dir_is_neg[0] ? x.min : x.max) - r.origin.x) * r.inv_dir.x;
+    real t_near_y = ((r.dir_is_neg[1] ? y.max : y.min) - r.origin.y) * r.inv_dir.y;
+    real t_far_y = ((r.dir_is_neg[1] ? y.min : y.max) - r.origin.y) * r.inv_dir.y;
+    real t_near_z = ((r.dir_is_neg[2] ? z.max : z.min) - r.origin.z) * r.inv_dir.z;
+    real t_far_z = ((r.dir_is_neg[2] ? z.min : z.max) - r.origin.z) * r.inv_dir.z;
+    ray_t.min = std::max(std::max(std::max(ray_t.min, t_near_x), t_near_y), t_near_z);
+    ray_t.max = std::min(std::min(std::min(ray_t.max, t_far_x), t_far_y), t_far_z);
+    return ray_t.min <= ray_t.max;
+  }
+
+  [[nodiscard]] vec3 Centroid() const {
+    return vec3{x.min + x.max, y.min + y.max, z.min + z.max} * static_cast<real>(0.5);
+  }
+
+  [[nodiscard]] real SurfaceArea() const {
+    real dx = x.Size(), dy = y.Size(), dz = z.Size();
+    return 2 * (dx * dy + dy * dz + dz * dx);
+  }
+
+  // bounds of the eight transformed corners
+  [[nodiscard]] AABB Transformed(const mat4& transform) const {
+    vec3 new_min{kInfinity}, new_max{-kInfinity};
+    for (int i = 0; i < 8; i++) {
+      vec3 corner{i & 1 ? x.max : x.min, i & 2 ? y.max : y.min, i & 4 ? z.max : z.min};
+      vec3 transformed_corner = vec3(transform * vec4(corner, 1));
+      new_min = glm::min(new_min, transformed_corner);
+      new_max = glm::max(new_max, transformed_corner);
     }
-    return true;
+    return AABB{new_min, new_max};
   }
 
   [[nodiscard]] int LongestAxis() const {
@@ -1,56 +1,831 @@
 #include "BVH.hpp"
 
+#include <tbb/blocked_range.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_invoke.h>
+#include <tbb/parallel_reduce.h>
+
+#include <atomic>
+#include <bit>
+#include <deque>
+#include <execution>
+
 #include "Defs.hpp"
-#include "Scene.hpp"
-#include "Sphere.hpp"
-#include "cpu_raytrace/Math.hpp"
+#include "cpu_raytrace/HitRecord.hpp"
+#include "cpu_raytrace/Mesh.hpp"
+#include "cpu_raytrace/Ray.hpp"
+#include "cpu_raytrace/Transform.hpp"
+#include "cpu_raytrace/WideNodeTest.hpp"
 
 namespace raytrace2::cpu {
 
-BVHNode::BVHNode(std::vector<std::shared_ptr<Hittable>>& objects, size_t start, size_t end) {
-  using Comparator = bool (*)(const std::shared_ptr<Hittable>&, const std::shared_ptr<Hittable>&);
-  std::array<Comparator, 3> comparators = {BoxCompareX, BoxCompareY, BoxCompareZ};
-  size_t object_span = end - start;
+namespace {
+
+constexpr size_t kMaxBins = 64;
+// nodes with at least this many primitives compute their bounds, bins and partition in parallel
+constexpr size_t kParallelBinningThreshold = 64 * 1024;
+// nodes with at least this many primitives build their two subtrees as separate tasks
+constexpr size_t kParallelSubtreeThreshold = 1024;
+// each level of wide nodes grows the stack by at most all but one of the children
+constexpr size_t kWideStackSize = BVH::kMaxDepth * (WideBVHNode::kWidth - 1) + 1;
+// levels of the tree whose boxes are transformed when bounding an instance
+constexpr size_t kTransformedBoundsDepth = 6;
+
+static_assert(SphereBlock::kWidth == TriangleBlock::kWidth);
+constexpr uint32_t kBlockWidth = SphereBlock::kWidth;
+
+// intersection tests of a leaf, where each block of its packed primitives counts as one
+real LeafIntersections(size_t num_primitives, size_t num_in_blocks) {
+  size_t num_blocks = (num_in_blocks + kBlockWidth - 1) / kBlockWidth;
+  return static_cast<real>(num_primitives - num_in_blocks + num_blocks);
+}
+
+class SceneBVHBuilder {
+ public:
+  explicit SceneBVHBuilder(const BVHBuildSettings& settings) : settings_(settings) {}
+
+  void CountReferences(const Hittable* obj) {
+    // the children are counted once however often their parent is referenced
+    if (ref_counts_[obj]++ > 0) return;
+    if (const auto* list = dynamic_cast<const HittableList*>(obj)) {
+      for (const auto& child : list->objects) CountReferences(child.get());
+    } else if (const auto* instance = dynamic_cast<const TransformedHittable*>(obj)) {
+      CountReferences(instance->obj.get());
+    }
+  }
+
+  // appends the primitives and instances making up obj to prims
+  void Gather(const std::shared_ptr<Hittable>& obj,
+              std::vector<std::shared_ptr<Hittable>>& prims) {
+    const auto* list = dynamic_cast<const HittableList*>(obj.get());
+    if (list && ref_counts_[list] == 1) {
+      for (const auto& child : list->objects) Gather(child, prims);
+    } else {
+      prims.emplace_back(GetAccel(obj));
+    }
+  }
+
+  // returns the shared bottom-level BVH of a list or the instance of a transform
+  std::shared_ptr<Hittable> GetAccel(const std::shared_ptr<Hittable>& obj) {
+    auto it = accels_.find(obj.get());
+    if (it != accels_.end()) return it->second;
+    std::shared_ptr<Hittable> accel = obj;
+    if (const auto* list = dynamic_cast<const HittableList*>(obj.get())) {
+      std::vector<std::shared_ptr<Hittable>> prims;
+      for (const auto& child : list->objects) Gather(child, prims);
+      accel = std::make_shared<BVH>(std::move(prims), settings_);
+    } else if (const auto* instance = dynamic_cast<const TransformedHittable*>(obj.get())) {
+      accel = std::make_shared<TransformedHittable>(GetAccel(instance->obj), instance->model);
+    }
+    accels_.emplace(obj.get(), accel);
+    return accel;
+  }
+
+ private:
+  BVHBuildSettings settings_;
+  std::unordered_map<const Hittable*, uint32_t> ref_counts_;
+  std::unordered_map<const Hittable*, std::shared_ptr<Hittable>> accels_;
+};
+
+}  // namespace
+
+struct BVH::BuildNode {
+  AABB aabb;
+  BuildNode* children[2]{nullptr, nullptr};
+  uint32_t primitives_offset{0};
+  uint32_t num_primitives{0};
+  uint8_t axis{0};
+};
+
+struct BVH::BuildBounds {
+  AABB aabb;
+  vec3 centroid_min{kInfinity};
+  vec3 centroid_max{-kInfinity};
+  size_t num_in_blocks{0};
+
+  void Add(const BuildPrimitive& prim) {
+    num_in_blocks += prim.in_block;
+    aabb = AABB{aabb, prim.aabb};
+    centroid_min = glm::min(centroid_min, prim.centroid);
+    centroid_max = glm::max(centroid_max, prim.centroid);
+  }
+  void Add(const BuildBounds& other) {
+    num_in_blocks += other.num_in_blocks;
+    aabb = AABB{aabb, other.aabb};
+    centroid_min = glm::min(centroid_min, other.centroid_min);
+    centroid_max = glm::max(centroid_max, other.centroid_max);
+  }
+};
+
+// per thread node storage, deques keep node pointers stable as they grow
+struct BVH::BuildArena {
+  tbb::enumerable_thread_specific<std::deque<BuildNode>> nodes;
+  std::atomic<size_t> num_nodes{0};
+
+  BuildNode* Alloc() {
+    num_nodes.fetch_add(1, std::memory_order_relaxed);
+    return &nodes.local().emplace_back();
+  }
+};
+
+BVH::BVH(std::vector<std::shared_ptr<Hittable>> objects, const BVHBuildSettings& settings)
+    : settings_(settings) {
+  settings_.max_leaf_size = std::clamp<size_t>(settings_.max_leaf_size, 1, UINT16_MAX);
+  settings_.num_bins = std::clamp<size_t>(settings_.num_bins, 2, kMaxBins);
+  if (objects.empty()) return;
+  std::vector<BuildPrimitive> build_prims(objects.size());
+  tbb::parallel_for(tbb::blocked_range<size_t>(0, objects.size()),
+                    [&](const tbb::blocked_range<size_t>& range) {
+                      for (size_t i = range.begin(); i < range.end(); i++) {
+                        AABB aabb = objects[i]->GetAABB();
+                        build_prims[i] = {
+                            .aabb = aabb,
+                            .centroid = aabb.Centroid(),
+                            .primitive_idx = static_cast<uint32_t>(i),
+                            .in_block = dynamic_cast<const Sphere*>(objects[i].get()) != nullptr};
+                      }
+                    });
+
+  BuildNodes(build_prims);
+  SetPrimitives(objects, build_prims);
+  PackLeafSpheres();
+
+  if (settings_.width == WideBVHNode::kWidth) {
+    wide_nodes_.reserve(nodes_.size());
+    Collapse(0);
+  }
+}
+
+BVH::BVH(const TriangleMesh& mesh, const BVHBuildSettings& settings)
+    : mesh_(&mesh), settings_(settings) {
+  settings_.max_leaf_size = std::clamp<size_t>(settings_.max_leaf_size, 1, UINT16_MAX);
+  settings_.num_bins = std::clamp<size_t>(settings_.num_bins, 2, kMaxBins);
+  const MeshData& data = *mesh.data;
+  size_t num_triangles = data.NumTriangles();
+  if (num_triangles == 0) return;
+  std::vector<BuildPrimitive> build_prims(num_triangles);
+  tbb::parallel_for(tbb::blocked_range<size_t>(0, num_triangles),
+                    [&](const tbb::blocked_range<size_t>& range) {
+                      for (size_t i = range.begin(); i < range.end(); i++) {
+                        AABB aabb{AABB{data.Position(i, 0), data.Position(i, 1)},
+                                  AABB{data.Position(i, 2), data.Position(i, 2)}};
+                        build_prims[i] = {.aabb = aabb,
+                                          .centroid = aabb.Centroid(),
+                                          .primitive_idx = static_cast<uint32_t>(i),
+                                          .in_block = true};
+                      }
+                    });
+
+  BuildNodes(build_prims);
+  triangles_.resize(num_triangles);
+  tbb::parallel_for(tbb::blocked_range<size_t>(0, num_triangles),
+                    [&](const tbb::blocked_range<size_t>& range) {
+                      for (size_t i = range.begin(); i < range.end(); i++) {
+                        triangles_[i] = build_prims[i].primitive_idx;
+                      }
+                    });
+  PackLeafTriangles();
+
+  if (settings_.width == WideBVHNode::kWidth) {
+    wide_nodes_.reserve(nodes_.size());
+    Collapse(0);
+  }
+}
+
+void BVH::BuildNodes(std::span<BuildPrimitive> build_prims) {
+  BuildArena arena;
+  BuildNode* root = Build(build_prims, 0, 0, arena);
+  // leaves reference ranges of build_prims, which is now in leaf order
+  nodes_.reserve(arena.num_nodes.load());
+  Flatten(root);
+}
+
+BVH::BuildNode* BVH::Build(std::span<BuildPrimitive> build_prims, size_t primitives_offset,
+                           size_t depth, BuildArena& arena) const {
+  BuildNode* node = arena.Alloc();
+
+  BuildBounds bounds;
+  if (build_prims.size() >= kParallelBinningThreshold) {
+    bounds = tbb::parallel_reduce(
+        tbb::blocked_range<size_t>(0, build_prims.size()), BuildBounds{},
+        [&](const tbb::blocked_range<size_t>& range, BuildBounds partial) {
+          for (size_t i = range.begin(); i < range.end(); i++) partial.Add(build_prims[i]);
+          return partial;
+        },
+        [](BuildBounds a, const BuildBounds& b) {
+          a.Add(b);
+          return a;
+        });
+  } else {
+    for (const BuildPrimitive& prim : build_prims) bounds.Add(prim);
+  }
+  node->aabb = bounds.aabb;
+
+  size_t mid = 0;
+  if (build_prims.size() > 1) {
+    if (settings_.split_method == BVHSplitMethod::kSAH && depth < kMaxDepth / 2) {
+      mid = PartitionSAH(build_prims, bounds);
+    } else if (build_prims.size() > settings_.max_leaf_size) {
+      mid = PartitionMedian(build_prims, bounds.aabb.LongestAxis());
+    }
+  }
+
+  if (mid == 0) {
+    node->primitives_offset = static_cast<uint32_t>(primitives_offset);
+    node->num_primitives = static_cast<uint32_t>(build_prims.size());
+    return node;
+  }
+
+  node->axis = static_cast<uint8_t>(bounds.aabb.LongestAxis());
+  auto build_left = [&]() {
+    node->children[0] = Build(build_prims.subspan(0, mid), primitives_offset, depth + 1, arena);
+  };
+  auto build_right = [&]() {
+    node->children[1] =
+        Build(build_prims.subspan(mid), primitives_offset + mid, depth + 1, arena);
+  };
+  if (build_prims.size() >= kParallelSubtreeThreshold) {
+    tbb::parallel_invoke(build_left, build_right);
+  } else {
+    build_left();
+    build_right();
+  }
+  return node;
+}
+
+uint32_t BVH::Flatten(const BuildNode* node) {
+  auto node_idx = static_cast<uint32_t>(nodes_.size());
+  nodes_.emplace_back();
+  if (node->children[0] == nullptr) {
+    LinearBVHNode& linear_node = nodes_[node_idx];
+    linear_node.aabb = node->aabb;
+    linear_node.primitives_offset = node->primitives_offset;
+    linear_node.num_primitives = static_cast<uint16_t>(node->num_primitives);
+    return node_idx;
+  }
+  Flatten(node->children[0]);
+  uint32_t second_child = Flatten(node->children[1]);
+  LinearBVHNode& linear_node = nodes_[node_idx];
+  linear_node.aabb = node->aabb;
+  linear_node.second_child_offset = second_child;
+  linear_node.num_primitives = 0;
+  linear_node.axis = node->axis;
+  return node_idx;
+}
+
+uint32_t BVH::Collapse(uint32_t node_idx) {
+  std::array<uint32_t, WideBVHNode::kWidth> slots;
+  uint32_t num_slots = 0;
+  const LinearBVHNode& node = nodes_[node_idx];
+  if (node.num_primitives > 0) {
+    slots[num_slots++] = node_idx;
+  } else {
+    slots[num_slots++] = node_idx + 1;
+    slots[num_slots++] = node.second_child_offset;
+  }
+  while (num_slots < WideBVHNode::kWidth) {
+    int largest = -1;
+    real largest_area = -1;
+    for (uint32_t i = 0; i < num_slots; i++) {
+      const LinearBVHNode& child = nodes_[slots[i]];
+      if (child.num_primitives == 0 && child.aabb.SurfaceArea() > largest_area) {
+        largest = static_cast<int>(i);
+        largest_area = child.aabb.SurfaceArea();
+      }
+    }
+    if (largest == -1) break;
+    uint32_t open = slots[largest];
+    slots[largest] = open + 1;
+    slots[num_slots++] = nodes_[open].second_child_offset;
+  }
+
+  auto wide_idx = static_cast<uint32_t>(wide_nodes_.size());
+  WideBVHNode wide_node{};
+  for (uint32_t i = 0; i < WideBVHNode::kWidth; i++) {
+    wide_node.min_x[i] = wide_node.min_y[i] = wide_node.min_z[i] = kInfinity;
+    wide_node.max_x[i] = wide_node.max_y[i] = wide_node.max_z[i] = -kInfinity;
+  }
+  wide_nodes_.emplace_back(wide_node);
+  for (uint32_t i = 0; i < num_slots; i++) {
+    const LinearBVHNode& child = nodes_[slots[i]];
+    uint32_t child_ref = child.primitives_offset;
+    if (child.num_primitives == 0) {
+      child_ref = Collapse(slots[i]);
+    }
+    // wide_nodes_ may have reallocated during recursion
+    WideBVHNode& wide = wide_nodes_[wide_idx];
+    wide.min_x[i] = static_cast<float>(child.aabb.x.min);
+    wide.min_y[i] = static_cast<float>(child.aabb.y.min);
+    wide.min_z[i] = static_cast<float>(child.aabb.z.min);
+    wide.max_x[i] = static_cast<float>(child.aabb.x.max);
+    wide.max_y[i] = static_cast<float>(child.aabb.y.max);
+    wide.max_z[i] = static_cast<float>(child.aabb.z.max);
+    wide.children[i] = child_ref;
+    wide.num_primitives[i] = child.num_primitives;
+  }
+  return wide_idx;
+}
+
+void BVH::SetPrimitives(std::vector<std::shared_ptr<Hittable>>& objects,
+                        std::span<BuildPrimitive> build_prims) {
+  for (const LinearBVHNode& node : nodes_) {
+    if (node.num_primitives == 0) continue;
+    auto leaf = build_prims.subspan(node.primitives_offset, node.num_primitives);
+    std::stable_partition(leaf.begin(), leaf.end(),
+                          [](const BuildPrimitive& prim) { return prim.in_block; });
+  }
+  handles_.resize(objects.size());
+  auto handle = [](PrimitiveType type, size_t index) {
+    return PrimitiveHandle{static_cast<uint32_t>(type), static_cast<uint32_t>(index)};
+  };
+  for (size_t i = 0; i < objects.size(); i++) {
+    std::shared_ptr<Hittable>& obj = objects[build_prims[i].primitive_idx];
+    if (const auto* sphere = dynamic_cast<const Sphere*>(obj.get())) {
+      handles_[i] = handle(PrimitiveType::kSphere, spheres_.size());
+      spheres_.emplace_back(*sphere);
+    } else if (const auto* quad = dynamic_cast<const Quad*>(obj.get())) {
+      handles_[i] = handle(PrimitiveType::kQuad, quads_.size());
+      quads_.emplace_back(*quad);
+    } else if (const auto* box = dynamic_cast<const Box*>(obj.get())) {
+      handles_[i] = handle(PrimitiveType::kBox, boxes_.size());
+      boxes_.emplace_back(*box);
+    } else {
+      handles_[i] = handle(PrimitiveType::kOther, others_.size());
+      others_.emplace_back(std::move(obj));
+    }
+  }
+}
+
+const Hittable& BVH::Primitive(uint32_t primitive) const {
+  PrimitiveHandle handle = handles_[primitive];
+  switch (handle.Type()) {
+    case PrimitiveType::kSphere:
+      return spheres_[handle.index];
+    case PrimitiveType::kQuad:
+      return quads_[handle.index];
+    case PrimitiveType::kBox:
+      return boxes_[handle.index];
+    case PrimitiveType::kOther:
+      break;
+  }
+  return *others_[handle.index];
+}
+
+void BVH::PackLeafSpheres() {
+  leaf_blocks_.assign(handles_.size(), {});
+  for (const LinearBVHNode& node : nodes_) {
+    if (node.num_primitives == 0) continue;
+    uint32_t num_spheres = 0;
+    while (num_spheres < node.num_primitives &&
+           handles_[node.primitives_offset + num_spheres].Type() == PrimitiveType::kSphere) {
+      num_spheres++;
+    }
+    leaf_blocks_[node.primitives_offset] = {static_cast<uint32_t>(sphere_blocks_.size()),
+                                            num_spheres};
+    for (uint32_t i = 0; i < num_spheres; i++) {
+      if (i % kBlockWidth == 0) sphere_blocks_.emplace_back();
+      sphere_blocks_.back().Set(i % kBlockWidth,
+                                spheres_[handles_[node.primitives_offset + i].index]);
+    }
+  }
+}
+
+void BVH::PackLeafTriangles() {
+  const MeshData& data = *mesh_->data;
+  leaf_blocks_.assign(triangles_.size(), {});
+  for (const LinearBVHNode& node : nodes_) {
+    if (node.num_primitives == 0) continue;
+    leaf_blocks_[node.primitives_offset] = {static_cast<uint32_t>(triangle_blocks_.size()),
+                                            node.num_primitives};
+    for (uint32_t i = 0; i < node.num_primitives; i++) {
+      uint32_t triangle = triangles_[node.primitives_offset + i];
+      if (i % kBlockWidth == 0) triangle_blocks_.emplace_back();
+      triangle_blocks_.back().Set(i % kBlockWidth, data.Position(triangle, 0),
+                                  data.Position(triangle, 1), data.Position(triangle, 2));
+    }
+  }
+}
+
+bool BVH::HitLeaf(const Scene& scene, const Ray& r, uint32_t primitives_offset,
+                  uint32_t num_primitives, Interval& ray_t, RNG& rng, ClosestHit& closest,
+                  HitRecord& rec) const {
+  bool hit_any = false;
+  const LeafBlocks& blocks = leaf_blocks_[primitives_offset];
+  if (mesh_) {
+    for (uint32_t i = 0; i < num_primitives; i += kBlockWidth) {
+      real t;
+      vec2 barycentric;
+      int lane = triangle_blocks_[blocks.first_block + i / kBlockWidth].NearestHit(
+          r, ray_t, t, barycentric);
+      if (lane < 0) continue;
+      closest = {primitives_offset + i + lane, t, barycentric};
+      hit_any = true;
+      ray_t.max = t;
+    }
+    return hit_any;
+  }
+  for (uint32_t i = 0; i < blocks.num_in_blocks; i += kBlockWidth) {
+    real t;
+    int lane = sphere_blocks_[blocks.first_block + i / kBlockWidth].NearestHit(r, ray_t, t);
+    if (lane < 0) continue;
+    closest = {primitives_offset + i + lane, t, {}};
+    hit_any = true;
+    ray_t.max = t;
+  }
+  for (uint32_t i = blocks.num_in_blocks; i < num_primitives; i++) {
+    if (HitPrimitive(scene, r, primitives_offset + i, ray_t, rng, closest, rec)) {
+      hit_any = true;
+      ray_t.max = closest.t;
+    }
+  }
+  return hit_any;
+}
 
-  for (size_t object_idx = start; object_idx < end; object_idx++) {
-    aabb_ = AABB{aabb_, objects[object_idx]->GetAABB()};
+bool BVH::OccludedLeaf(const Scene& scene, const Ray& r, uint32_t primitives_offset,
+                       uint32_t num_primitives, Interval ray_t, RNG& rng) const {
+  const LeafBlocks& blocks = leaf_blocks_[primitives_offset];
+  if (mesh_) {
+    for (uint32_t i = 0; i < num_primitives; i += kBlockWidth) {
+      real t;
+      vec2 barycentric;
+      if (triangle_blocks_[blocks.first_block + i / kBlockWidth].NearestHit(r, ray_t, t,
+                                                                            barycentric) >= 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+  for (uint32_t i = 0; i < blocks.num_in_blocks; i += kBlockWidth) {
+    real t;
+    if (sphere_blocks_[blocks.first_block + i / kBlockWidth].NearestHit(r, ray_t, t) >= 0) {
+      return true;
+    }
+  }
+  for (uint32_t i = blocks.num_in_blocks; i < num_primitives; i++) {
+    if (OccludedPrimitive(scene, r, primitives_offset + i, ray_t, rng)) return true;
   }
-  if (object_span == 1) {
-    left_ = objects[start];
-    right_ = objects[start];
-  } else if (object_span == 2) {
-    left_ = objects[start];
-    right_ = objects[start + 1];
+  return false;
+}
+
+bool BVH::HitPrimitive(const Scene& scene, const Ray& r, uint32_t primitive, Interval ray_t,
+                       RNG& rng, ClosestHit& closest, HitRecord& rec) const {
+  PrimitiveHandle handle = handles_[primitive];
+  real t;
+  vec2 params{};
+  bool hit = false;
+  switch (handle.Type()) {
+    case PrimitiveType::kSphere:
+      hit = spheres_[handle.index].Intersect(r, ray_t, t);
+      break;
+    case PrimitiveType::kQuad:
+      hit = quads_[handle.index].Intersect(r, ray_t, t, params);
+      break;
+    case PrimitiveType::kBox:
+      hit = boxes_[handle.index].Intersect(r, ray_t, t);
+      break;
+    case PrimitiveType::kOther:
+      hit = others_[handle.index]->Hit(scene, r, ray_t, rng, rec);
+      if (hit) closest = {ClosestHit::kInRecord, rec.t, {}};
+      return hit;
+  }
+  if (hit) closest = {primitive, t, params};
+  return hit;
+}
+
+bool BVH::OccludedPrimitive(const Scene& scene, const Ray& r, uint32_t primitive,
+                            Interval ray_t, RNG& rng) const {
+  PrimitiveHandle handle = handles_[primitive];
+  switch (handle.Type()) {
+    case PrimitiveType::kSphere:
+      return spheres_[handle.index].Occluded(scene, r, ray_t, rng);
+    case PrimitiveType::kQuad:
+      return quads_[handle.index].Occluded(scene, r, ray_t, rng);
+    case PrimitiveType::kBox:
+      return boxes_[handle.index].Occluded(scene, r, ray_t, rng);
+    case PrimitiveType::kOther:
+      break;
+  }
+  return others_[handle.index]->Occluded(scene, r, ray_t, rng);
+}
+
+size_t BVH::PartitionMedian(std::span<BuildPrimitive> build_prims, int axis) {
+  auto mid = build_prims.size() / 2;
+  std::nth_element(build_prims.begin(), build_prims.begin() + mid, build_prims.end(),
+                   [axis](const BuildPrimitive& a, const BuildPrimitive& b) {
+                     return a.aabb.AxisInterval(axis).min < b.aabb.AxisInterval(axis).min;
+                   });
+  return mid;
+}
+
+size_t BVH::PartitionSAH(std::span<BuildPrimitive> build_prims, const BuildBounds& bounds) const {
+  vec3 extent = bounds.centroid_max - bounds.centroid_min;
+  int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+  bool must_split = build_prims.size() > settings_.max_leaf_size;
+  if (extent[axis] <= 0) {
+    // every centroid coincides, binning can't separate them
+    return must_split ? PartitionMedian(build_prims, axis) : 0;
+  }
+
+  struct Bin {
+    AABB aabb;
+    size_t count{0};
+  };
+  using Bins = std::array<Bin, kMaxBins>;
+  const size_t num_bins = settings_.num_bins;
+  const real centroid_min = bounds.centroid_min[axis];
+  const real bin_scale = static_cast<real>(num_bins) / extent[axis];
+  auto bin_idx = [&](const BuildPrimitive& prim) {
+    auto b = static_cast<size_t>((prim.centroid[axis] - centroid_min) * bin_scale);
+    return std::min(b, num_bins - 1);
+  };
+  auto bin_range = [&](const tbb::blocked_range<size_t>& range, Bins bins) {
+    for (size_t i = range.begin(); i < range.end(); i++) {
+      Bin& bin = bins[bin_idx(build_prims[i])];
+      bin.aabb = AABB{bin.aabb, build_prims[i].aabb};
+      bin.count++;
+    }
+    return bins;
+  };
+  Bins bins;
+  tbb::blocked_range<size_t> all_prims(0, build_prims.size());
+  if (build_prims.size() >= kParallelBinningThreshold) {
+    bins = tbb::parallel_reduce(all_prims, Bins{}, bin_range, [num_bins](Bins a, const Bins& b) {
+      for (size_t i = 0; i < num_bins; i++) {
+        if (b[i].count == 0) continue;
+        a[i].aabb = AABB{a[i].aabb, b[i].aabb};
+        a[i].count += b[i].count;
+      }
+      return a;
+    });
   } else {
-    std::sort(std::begin(objects) + start, std::begin(objects) + end,
-              comparators[aabb_.LongestAxis()]);
-    auto mid = start + object_span / 2;
-    left_ = std::make_shared<BVHNode>(objects, start, mid);
-    right_ = std::make_shared<BVHNode>(objects, mid, end);
+    bins = bin_range(all_prims, Bins{});
+  }
+
+  // sweep from the right to get the area and count above each split, then from the left
+  std::array<real, kMaxBins> cost_above{};
+  AABB above;
+  size_t count_above = 0;
+  for (size_t i = num_bins - 1; i > 0; i--) {
+    if (bins[i].count > 0) above = AABB{above, bins[i].aabb};
+    count_above += bins[i].count;
+    cost_above[i - 1] = count_above > 0 ? count_above * above.SurfaceArea() : kInfinity;
   }
+  real best_cost = kInfinity;
+  size_t best_split = 0;
+  AABB below;
+  size_t count_below = 0;
+  for (size_t i = 0; i < num_bins - 1; i++) {
+    if (bins[i].count > 0) below = AABB{below, bins[i].aabb};
+    count_below += bins[i].count;
+    if (count_below == 0 || count_below == build_prims.size()) continue;
+    real cost = count_below * below.SurfaceArea() + cost_above[i];
+    if (cost < best_cost) {
+      best_cost = cost;
+      best_split = i;
+    }
+  }
+
+  best_cost = kTraversalCost + kIntersectionCost * best_cost / bounds.aabb.SurfaceArea();
+  real leaf_cost =
+      kIntersectionCost * LeafIntersections(build_prims.size(), bounds.num_in_blocks);
+  if (!must_split && leaf_cost <= best_cost) return 0;
+
+  auto in_first_half = [&](const BuildPrimitive& p) { return bin_idx(p) <= best_split; };
+  auto it = build_prims.size() >= kParallelBinningThreshold
+                ? std::partition(std::execution::par, build_prims.begin(), build_prims.end(),
+                                 in_first_half)
+                : std::partition(build_prims.begin(), build_prims.end(), in_first_half);
+  return static_cast<size_t>(it - build_prims.begin());
+}
+
+real BVH::SAHCost() const {
+  if (nodes_.empty()) return 0;
+  real root_area = nodes_.front().aabb.SurfaceArea();
+  real cost = 0;
+  for (const LinearBVHNode& node : nodes_) {
+    real node_cost = node.num_primitives > 0
+                         ? kIntersectionCost *
+                               LeafIntersections(node.num_primitives,
+                                                 leaf_blocks_[node.primitives_offset].num_in_blocks)
+                         : kTraversalCost;
+    cost += node_cost * node.aabb.SurfaceArea() / root_area;
+  }
+  return cost;
 }
 
-bool BVHNode::BoxCompare(const std::shared_ptr<Hittable>& a, const std::shared_ptr<Hittable>& b,
-                         int axis_idx) {
-  auto a_ai = a->GetAABB().AxisInterval(axis_idx);
-  auto b_ai = b->GetAABB().AxisInterval(axis_idx);
-  return a_ai.min < b_ai.min;
+AABB BVH::GetTransformedAABB(const mat4& transform) const {
+  AABB aabb;
+  if (nodes_.empty()) return aabb;
+  std::vector<std::pair<uint32_t, size_t>> to_visit{{0, 0}};
+  while (!to_visit.empty()) {
+    auto [node_idx, depth] = to_visit.back();
+    to_visit.pop_back();
+    const LinearBVHNode& node = nodes_[node_idx];
+    if (node.num_primitives > 0 && mesh_) {
+      for (uint32_t i = 0; i < node.num_primitives; i++) {
+        uint32_t triangle = triangles_[node.primitives_offset + i];
+        for (int corner = 0; corner < 3; corner++) {
+          vec3 p = vec3(transform * vec4(mesh_->data->Position(triangle, corner), 1));
+          aabb = AABB{aabb, AABB{p, p}};
+        }
+      }
+    } else if (node.num_primitives > 0) {
+      for (uint32_t i = 0; i < node.num_primitives; i++) {
+        aabb = AABB{aabb, Primitive(node.primitives_offset + i).GetTransformedAABB(transform)};
+      }
+    } else if (depth == kTransformedBoundsDepth) {
+      aabb = AABB{aabb, node.aabb.Transformed(transform)};
+    } else {
+      to_visit.emplace_back(node_idx + 1, depth + 1);
+      to_visit.emplace_back(node.second_child_offset, depth + 1);
+    }
+  }
+  return aabb;
 }
 
-bool BVHNode::BoxCompareX(const std::shared_ptr<Hittable>& a, const std::shared_ptr<Hittable>& b) {
-  return BoxCompare(a, b, 0);
+std::shared_ptr<BVH> BuildSceneBVH(const HittableList& list, const BVHBuildSettings& settings) {
+  SceneBVHBuilder builder{settings};
+  for (const auto& obj : list.objects) builder.CountReferences(obj.get());
+  std::vector<std::shared_ptr<Hittable>> prims;
+  for (const auto& obj : list.objects) builder.Gather(obj, prims);
+  return std::make_shared<BVH>(std::move(prims), settings);
 }
-bool BVHNode::BoxCompareY(const std::shared_ptr<Hittable>& a, const std::shared_ptr<Hittable>& b) {
-  return BoxCompare(a, b, 1);
+
+bool BVH::Hit(const Scene& scene, const Ray& r, Interval ray_t, RNG& rng,
+              HitRecord& rec) const {
+  const TraversalRay tr{r};
+  ClosestHit closest;
+  bool hit = wide_nodes_.empty() ? HitBinary(scene, r, tr, ray_t, rng, closest, rec)
+                                 : HitWide(scene, r, tr, ray_t, rng, closest, rec);
+  if (hit) FinalizeHit(scene, r, closest, rec);
+  return hit;
 }
-bool BVHNode::BoxCompareZ(const std::shared_ptr<Hittable>& a, const std::shared_ptr<Hittable>& b) {
-  return BoxCompare(a, b, 2);
+
+void BVH::FinalizeHit(const Scene& scene, const Ray& r, const ClosestHit& closest,
+                      HitRecord& rec) const {
+  if (closest.primitive == ClosestHit::kInRecord) return;
+  if (mesh_) {
+    mesh_->SetHitRecord(scene, r, triangles_[closest.primitive], closest.t, closest.params, rec);
+    return;
+  }
+  PrimitiveHandle handle = handles_[closest.primitive];
+  switch (handle.Type()) {
+    case PrimitiveType::kSphere:
+      spheres_[handle.index].SetHitRecord(scene, r, closest.t, rec);
+      break;
+    case PrimitiveType::kQuad:
+      quads_[handle.index].SetHitRecord(scene, r, closest.t, closest.params, rec);
+      break;
+    case PrimitiveType::kBox:
+      boxes_[handle.index].SetHitRecord(scene, r, closest.t, rec);
+      break;
+    case PrimitiveType::kOther:
+      // filled rec while traversing
+      break;
+  }
 }
 
-bool BVHNode::Hit(const Scene& scene, const Ray& r, Interval ray_t, HitRecord& rec) const {
-  if (!aabb_.Hit(r, ray_t)) return false;
-  bool hit_left = left_->Hit(scene, r, ray_t, rec);
-  bool hit_right = right_->Hit(scene, r, Interval{ray_t.min, hit_left ? rec.t : ray_t.max}, rec);
-  return hit_left || hit_right;
+bool BVH::Occluded(const Scene& scene, const Ray& r, Interval ray_t, RNG& rng) const {
+  const TraversalRay tr{r};
+  if (!wide_nodes_.empty()) return OccludedWide(scene, r, tr, ray_t, rng);
+  return OccludedBinary(scene, r, tr, ray_t, rng);
 }
+
+bool BVH::HitWide(const Scene& scene, const Ray& r, const TraversalRay& tr, Interval ray_t,
+                  RNG& rng, ClosestHit& closest, HitRecord& rec) const {
+  struct StackEntry {
+    uint32_t child;
+    uint32_t num_primitives;
+    real t_near;
+  };
+  StackEntry stack[kWideStackSize];
+  size_t stack_size = 0;
+  stack[stack_size++] = {0, 0, ray_t.min};
+  const detail::WideTraversalRay wr{tr};
+
+  bool hit_any = false;
+  while (stack_size > 0) {
+    const StackEntry entry = stack[--stack_size];
+    // a closer hit may have been found since this child was pushed
+    if (entry.t_near > ray_t.max) continue;
+    if (entry.num_primitives > 0) {
+      hit_any |= HitLeaf(scene, r, entry.child, entry.num_primitives, ray_t, rng, closest, rec);
+      continue;
+    }
+
+    const WideBVHNode& node = wide_nodes_[entry.child];
+    alignas(16) float t_near[WideBVHNode::kWidth];
+    int hit_mask = detail::IntersectChildren(node, wr, ray_t, t_near);
+    if (hit_mask == 0) continue;
+
+    // push the hit children far to near so the nearest is traversed first
+    uint32_t order[WideBVHNode::kWidth];
+    uint32_t num_hit = 0;
+    for (uint32_t i = 0; i < WideBVHNode::kWidth; i++) {
+      if (!(hit_mask & (1 << i))) continue;
+      uint32_t j = num_hit++;
+      for (; j > 0 && t_near[order[j - 1]] < t_near[i]; j--) order[j] = order[j - 1];
+      order[j] = i;
+    }
+    EASSERT(stack_size + num_hit <= kWideStackSize);
+    for (uint32_t i = 0; i < num_hit; i++) {
+      uint32_t slot = order[i];
+      stack[stack_size++] = {node.children[slot], node.num_primitives[slot], t_near[slot]};
+    }
+  }
+  return hit_any;
+}
+
+bool BVH::OccludedWide(const Scene& scene, const Ray& r, const TraversalRay& tr, Interval ray_t,
+                       RNG& rng) const {
+  struct StackEntry {
+    uint32_t child;
+    uint32_t num_primitives;
+  };
+  StackEntry stack[kWideStackSize];
+  size_t stack_size = 0;
+  stack[stack_size++] = {0, 0};
+  const detail::WideTraversalRay wr{tr};
+
+  while (stack_size > 0) {
+    const StackEntry entry = stack[--stack_size];
+    if (entry.num_primitives > 0) {
+      if (OccludedLeaf(scene, r, entry.child, entry.num_primitives, ray_t, rng)) return true;
+      continue;
+    }
+
+    const WideBVHNode& node = wide_nodes_[entry.child];
+    alignas(16) float t_near[WideBVHNode::kWidth];
+    int hit_mask = detail::IntersectChildren(node, wr, ray_t, t_near);
+    // any hit ends the query, so children are visited in slot order without sorting
+    EASSERT(stack_size + std::popcount(static_cast<unsigned>(hit_mask)) <= kWideStackSize);
+    for (uint32_t i = 0; i < WideBVHNode::kWidth; i++) {
+      if (hit_mask & (1 << i)) stack[stack_size++] = {node.children[i], node.num_primitives[i]};
+    }
+  }
+  return false;
+}
+
+bool BVH::HitBinary(const Scene& scene, const Ray& r, const TraversalRay& tr, Interval ray_t,
+                    RNG& rng, ClosestHit& closest, HitRecord& rec) const {
+  if (nodes_.empty()) return false;
+
+  uint32_t to_visit[kMaxDepth];
+  size_t to_visit_count = 0;
+  uint32_t curr = 0;
+  bool hit_any = false;
+  while (true) {
+    const LinearBVHNode& node = nodes_[curr];
+    if (node.aabb.Hit(tr, ray_t)) {
+      if (node.num_primitives > 0) {
+        hit_any |= HitLeaf(scene, r, node.primitives_offset, node.num_primitives, ray_t, rng,
+                           closest, rec);
+      } else {
+        // visit the near child first so the far one can be culled by the closer hit
+        EASSERT(to_visit_count < kMaxDepth);
+        if (tr.dir_is_neg[node.axis]) {
+          to_visit[to_visit_count++] = curr + 1;
+          curr = node.second_child_offset;
+        } else {
+          to_visit[to_visit_count++] = node.second_child_offset;
+          curr = curr + 1;
+        }
+        continue;
+      }
+    }
+    if (to_visit_count == 0) break;
+    curr = to_visit[--to_visit_count];
+  }
+  return hit_any;
+}
+
+bool BVH::OccludedBinary(const Scene& scene, const Ray& r, const TraversalRay& tr, Interval ray_t,
+                         RNG& rng) const {
+  if (nodes_.empty()) return false;
+
+  uint32_t to_visit[kMaxDepth];
+  size_t to_visit_count = 0;
+  uint32_t curr = 0;
+  while (true) {
+    const LinearBVHNode& node = nodes_[curr];
+    if (node.aabb.Hit(tr, ray_t)) {
+      if (node.num_primitives > 0) {
+        if (OccludedLeaf(scene, r, node.primitives_offset, node.num_primitives, ray_t, rng)) {
+          return true;
+        }
+      } else {
+        EASSERT(to_visit_count < kMaxDepth);
+        to_visit[to_visit_count++] = node.second_child_offset;
+        curr = curr + 1;
+        continue;
+      }
+    }
+    if (to_visit_count == 0) break;
+    curr = to_visit[--to_visit_count];
+  }
+  return false;
+}
+
 }  // namespace raytrace2::cpu
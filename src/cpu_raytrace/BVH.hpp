@@ -1,30 +1,196 @@
 #pragma once
 
 #include "cpu_raytrace/AABB.hpp"
+#include "cpu_raytrace/Box.hpp"
 #include "cpu_raytrace/HittableList.hpp"
+#include "cpu_raytrace/Quad.hpp"
+#include "cpu_raytrace/Sphere.hpp"
+#include "cpu_raytrace/Triangle.hpp"
 
 namespace raytrace2::cpu {
 
 struct Scene;
 struct HitRecord;
+struct TriangleMesh;
 
-struct BVHNode : public Hittable {
+// Node of a BVH flattened in depth first order. The first child of an interior node directly
+// follows it in the array, so only the offset of the second child is stored.
+struct LinearBVHNode {
+  AABB aabb;
+  union {
+    uint32_t primitives_offset;    // leaf
+    uint32_t second_child_offset;  // interior
+  };
+  uint16_t num_primitives;  // 0 for interior nodes
+  uint8_t axis;             // interior split axis, used for front to back traversal
+  uint8_t pad;
+};
+#ifndef DOUBLE
+static_assert(sizeof(LinearBVHNode) == 32);
+#endif
+
+// Node of the collapsed 4-wide BVH used for traversal. Child bounds are stored as structure of
+// arrays so one SIMD slab test covers every child. Unused slots have empty bounds and never hit.
+struct alignas(32) WideBVHNode {
+  static constexpr uint32_t kWidth = 4;
+  float min_x[kWidth], min_y[kWidth], min_z[kWidth];
+  float max_x[kWidth], max_y[kWidth], max_z[kWidth];
+  uint32_t children[kWidth];        // wide node index, or primitives offset for leaf children
+  uint16_t num_primitives[kWidth];  // 0 for interior children
+};
+
+enum class BVHSplitMethod {
+  kSAH,    // binned surface area heuristic over primitive centroids
+  kMedian  // equal counts along the longest axis, sorted by AABB min
+};
+
+struct BVHBuildSettings {
+  BVHSplitMethod split_method{BVHSplitMethod::kSAH};
+  size_t max_leaf_size{4};
+  size_t num_bins{16};
+  // 2 traverses the binary tree directly, 4 collapses it into WideBVHNodes
+  size_t width{4};
+};
+
+struct BVH : public Hittable {
  public:
-  explicit BVHNode(HittableList list) : BVHNode(list.objects, 0, list.objects.size()) {}
-  BVHNode(std::vector<std::shared_ptr<Hittable>> &objects, size_t start, size_t end);
-  bool Hit(const Scene &scene, const Ray &r, Interval ray_t, HitRecord &rec) const override;
-  [[nodiscard]] AABB GetAABB() const override { return aabb_; }
+  // relative costs used by the SAH, an intersection is the unit
+  static constexpr real kTraversalCost = 0.5;
+  static constexpr real kIntersectionCost = 1;
+  // bounds the traversal stack, SAH splits fall back to median splits past half of it
+  static constexpr size_t kMaxDepth = 128;
+
+  explicit BVH(const HittableList& list, const BVHBuildSettings& settings = {})
+      : BVH(list.objects, settings) {}
+  explicit BVH(std::vector<std::shared_ptr<Hittable>> objects,
+               const BVHBuildSettings& settings = {});
+  // BVH over the triangles of mesh, which has to outlive it
+  explicit BVH(const TriangleMesh& mesh, const BVHBuildSettings& settings = {});
+  bool Hit(const Scene& scene, const Ray& r, Interval ray_t, RNG& rng,
+           HitRecord& rec) const override;
+  bool Occluded(const Scene& scene, const Ray& r, Interval ray_t, RNG& rng) const override;
+  [[nodiscard]] AABB GetAABB() const override {
+    return nodes_.empty() ? AABB{} : nodes_.front().aabb;
+  }
+  // bounds the transformed boxes of the top levels of the tree, or of the primitives when a
+  // leaf is reached first
+  [[nodiscard]] AABB GetTransformedAABB(const mat4& transform) const override;
+
+  [[nodiscard]] size_t NumNodes() const { return nodes_.size(); }
+  [[nodiscard]] size_t NumWideNodes() const { return wide_nodes_.size(); }
+  [[nodiscard]] size_t NumPrimitives() const {
+    return mesh_ ? triangles_.size() : handles_.size();
+  }
+  // expected cost of a random ray through the tree relative to one primitive intersection
+  [[nodiscard]] real SAHCost() const;
 
  private:
-  std::shared_ptr<Hittable> left_;
-  std::shared_ptr<Hittable> right_;
-  AABB aabb_;
-
-  static bool BoxCompare(const std::shared_ptr<Hittable> &a, const std::shared_ptr<Hittable> &b,
-                         int axis_idx);
-  static bool BoxCompareX(const std::shared_ptr<Hittable> &a, const std::shared_ptr<Hittable> &b);
-  static bool BoxCompareY(const std::shared_ptr<Hittable> &a, const std::shared_ptr<Hittable> &b);
-  static bool BoxCompareZ(const std::shared_ptr<Hittable> &a, const std::shared_ptr<Hittable> &b);
+  struct BuildPrimitive {
+    AABB aabb;
+    vec3 centroid;
+    uint32_t primitive_idx;
+    // tested as a lane of a SphereBlock or TriangleBlock
+    bool in_block;
+  };
+  struct BuildNode;
+  struct BuildBounds;
+  struct BuildArena;
+
+  // Spheres, quads and boxes are copied into contiguous arrays by type, which own them from
+  // then on, and leaves pick the intersection routine with a switch on the handle of each
+  // primitive instead of a virtual call through a scattered allocation. Other primitives, such
+  // as instances, media and meshes, stay behind their Hittable. Lights are known by their
+  // index, which the copies keep, so hits on them need no mapping back to the original.
+  enum class PrimitiveType : uint32_t { kSphere, kQuad, kBox, kOther };
+  struct PrimitiveHandle {
+    uint32_t type : 2;
+    uint32_t index : 30;  // into the array of the type
+    [[nodiscard]] PrimitiveType Type() const { return static_cast<PrimitiveType>(type); }
+  };
+  static_assert(sizeof(PrimitiveHandle) == 4);
+  // in the order referenced by the leaves
+  std::vector<PrimitiveHandle> handles_;
+  std::vector<Sphere> spheres_;
+  std::vector<Quad> quads_;
+  std::vector<Box> boxes_;
+  std::vector<std::shared_ptr<Hittable>> others_;
+  // Each leaf lists its spheres first and also has them packed into blocks, which are tested
+  // in place of the spheres' own Hit and Occluded. Indexed by the leaf's primitives offset.
+  // In a mesh BVH every primitive is a triangle and is packed.
+  struct LeafBlocks {
+    uint32_t first_block;
+    uint32_t num_in_blocks;
+  };
+  std::vector<LeafBlocks> leaf_blocks_;
+  std::vector<SphereBlock> sphere_blocks_;
+  // set instead of the handles for a mesh BVH, with the mesh's triangle indices in leaf order
+  const TriangleMesh* mesh_{nullptr};
+  std::vector<uint32_t> triangles_;
+  std::vector<TriangleBlock> triangle_blocks_;
+  std::vector<LinearBVHNode> nodes_;
+  std::vector<WideBVHNode> wide_nodes_;
+  BVHBuildSettings settings_;
+
+  // Closest hit found so far during traversal. Primitives tested in place only report where
+  // they were hit, and the HitRecord is filled once for the closest of them after traversal.
+  // Other primitives fill rec themselves and leave primitive at kInRecord.
+  struct ClosestHit {
+    static constexpr uint32_t kInRecord = UINT32_MAX;
+    uint32_t primitive{kInRecord};  // in leaf order
+    real t;
+    vec2 params;  // barycentrics on a triangle, plane coordinates on a quad
+  };
+
+  // builds and flattens the tree, leaving build_prims in leaf order
+  void BuildNodes(std::span<BuildPrimitive> build_prims);
+  // builds the subtree over build_prims, which starts at primitives_offset in the final
+  // primitive order. Subtrees and the binning of large nodes run in parallel.
+  BuildNode* Build(std::span<BuildPrimitive> build_prims, size_t primitives_offset, size_t depth,
+                   BuildArena& arena) const;
+  // returns the size of the first half of build_prims after partitioning, 0 to make a leaf
+  size_t PartitionSAH(std::span<BuildPrimitive> build_prims, const BuildBounds& bounds) const;
+  static size_t PartitionMedian(std::span<BuildPrimitive> build_prims, int axis);
+  uint32_t Flatten(const BuildNode* node);
+  // pulls up the grandchildren of the largest interior children until the node is full
+  uint32_t Collapse(uint32_t node_idx);
+  // fills handles_ and the per-type arrays in leaf order, spheres first within each leaf
+  void SetPrimitives(std::vector<std::shared_ptr<Hittable>>& objects,
+                     std::span<BuildPrimitive> build_prims);
+  void PackLeafSpheres();
+  void PackLeafTriangles();
+
+  // test the primitives of the leaf starting at primitives_offset, Hit narrows ray_t to the
+  // closest hit
+  bool HitLeaf(const Scene& scene, const Ray& r, uint32_t primitives_offset,
+               uint32_t num_primitives, Interval& ray_t, RNG& rng, ClosestHit& closest,
+               HitRecord& rec) const;
+  bool OccludedLeaf(const Scene& scene, const Ray& r, uint32_t primitives_offset,
+                    uint32_t num_primitives, Interval ray_t, RNG& rng) const;
+  bool HitPrimitive(const Scene& scene, const Ray& r, uint32_t primitive, Interval ray_t,
+                    RNG& rng, ClosestHit& closest, HitRecord& rec) const;
+  bool OccludedPrimitive(const Scene& scene, const Ray& r, uint32_t primitive, Interval ray_t,
+                         RNG& rng) const;
+  // the primitive in leaf order, wherever it is stored
+  [[nodiscard]] const Hittable& Primitive(uint32_t primitive) const;
+
+  // fills rec for the closest hit unless a primitive already did
+  void FinalizeHit(const Scene& scene, const Ray& r, const ClosestHit& closest,
+                   HitRecord& rec) const;
+
+  bool HitBinary(const Scene& scene, const Ray& r, const TraversalRay& tr, Interval ray_t,
+                 RNG& rng, ClosestHit& closest, HitRecord& rec) const;
+  bool HitWide(const Scene& scene, const Ray& r, const TraversalRay& tr, Interval ray_t,
+               RNG& rng, ClosestHit& closest, HitRecord& rec) const;
+  bool OccludedBinary(const Scene& scene, const Ray& r, const TraversalRay& tr, Interval ray_t,
+                      RNG& rng) const;
+  bool OccludedWide(const Scene& scene, const Ray& r, const TraversalRay& tr, Interval ray_t,
+                    RNG& rng) const;
 };
 
+// Builds a two-level hierarchy over a scene graph. Lists under a transform or referenced from
+// more than one place get their own bottom-level BVH, built once and shared. Transforms become
+// instances of those BVHs, and the returned top-level BVH is built over the instance bounds and
+// the primitives of lists that are neither transformed nor shared, which are flattened into it.
+std::shared_ptr<BVH> BuildSceneBVH(const HittableList& list, const BVHBuildSettings& settings);
+
 }  // namespace raytrace2::cpu
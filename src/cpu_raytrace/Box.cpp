@@ -0,0 +1,109 @@
+#include "Box.hpp"
+
+#include "cpu_raytrace/HitRecord.hpp"
+#include "cpu_raytrace/Interval.hpp"
+#include "cpu_raytrace/Scene.hpp"
+
+namespace raytrace2::cpu {
+
+bool Box::Slabs(const Ray& r, real& t_near, real& t_far, int& near_axis, int& far_axis) const {
+  t_near = -kInfinity;
+  t_far = kInfinity;
+  near_axis = far_axis = 0;
+  for (int i = 0; i < 3; i++) {
+    real inv_dir = 1 / r.direction[i];
+    real t0 = (min[i] - r.origin[i]) * inv_dir;
+    real t1 = (max[i] - r.origin[i]) * inv_dir;
+    if (inv_dir < 0) std::swap(t0, t1);
+    // distances to a face plane the ray lies in are NaN and leave the interval untouched
+    if (t0 > t_near) {
+      t_near = t0;
+      near_axis = i;
+    }
+    if (t1 < t_far) {
+      t_far = t1;
+      far_axis = i;
+    }
+  }
+  return t_near <= t_far;
+}
+
+bool Box::Hit(const Scene& scene, const Ray& r, Interval ray_t, RNG&, HitRecord& rec) const {
+  real t;
+  if (!Intersect(r, ray_t, t)) return false;
+  SetHitRecord(scene, r, t, rec);
+  return true;
+}
+
+bool Box::Intersect(const Ray& r, Interval ray_t, real& t) const {
+  real t_near, t_far;
+  int near_axis, far_axis;
+  if (!Slabs(r, t_near, t_far, near_axis, far_axis)) return false;
+  // from inside the box, or a medium looking for its exit, the nearest hit is the exit
+  if (ray_t.Surrounds(t_near)) {
+    t = t_near;
+  } else if (ray_t.Surrounds(t_far)) {
+    t = t_far;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void Box::SetHitRecord(const Scene& scene, const Ray& r, real t, HitRecord& rec) const {
+  real t_near, t_far;
+  int near_axis, far_axis;
+  Slabs(r, t_near, t_far, near_axis, far_axis);
+  // the same arithmetic as Intersect, so t equals one of the distances exactly
+  bool entering = t == t_near;
+  int axis = entering ? near_axis : far_axis;
+  rec.t = t;
+  rec.point = r.At(t);
+  rec.material = &scene.materials[material_handle];
+  rec.object = nullptr;
+  // rays enter through the face of each axis that they travel against
+  bool max_face = (r.direction[axis] < 0) == entering;
+  vec3 outward_normal{0};
+  outward_normal[axis] = max_face ? 1 : -1;
+  rec.SetFaceNormal(r, outward_normal);
+  if (!SamplesTexture(*rec.material)) return;
+
+  vec3 local = (rec.point - min) / (max - min);
+  switch (axis) {
+    case 0:
+      rec.uv = {max_face ? 1 - local.z : local.z, local.y};
+      break;
+    case 1:
+      rec.uv = {local.x, max_face ? 1 - local.z : local.z};
+      break;
+    default:
+      rec.uv = {max_face ? local.x : 1 - local.x, local.y};
+      break;
+  }
+}
+
+bool Box::Occluded(const Scene&, const Ray& r, Interval ray_t, RNG&) const {
+  real t;
+  return Intersect(r, ray_t, t);
+}
+
+bool Box::Span(const Ray& r, real& t_enter, real& t_exit) const {
+  int near_axis, far_axis;
+  return Slabs(r, t_enter, t_exit, near_axis, far_axis);
+}
+
+std::shared_ptr<Hittable> Box::BakeTransform(const mat4& transform) const {
+  // each axis has to map onto an axis, as under translation, scaling and quarter turns
+  mat3 linear{transform};
+  constexpr real kEpsilon = 1e-6;
+  for (int i = 0; i < 3; i++) {
+    real tolerance = kEpsilon * glm::length(linear[i]);
+    int num_axes = (std::abs(linear[i].x) > tolerance) + (std::abs(linear[i].y) > tolerance) +
+                   (std::abs(linear[i].z) > tolerance);
+    if (num_axes != 1) return nullptr;
+  }
+  return std::make_shared<Box>(vec3(transform * vec4(min, 1)), vec3(transform * vec4(max, 1)),
+                               material_handle);
+}
+
+}  // namespace raytrace2::cpu
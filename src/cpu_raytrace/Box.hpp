@@ -0,0 +1,41 @@
+#pragma once
+
+#include "Defs.hpp"
+#include "cpu_raytrace/AABB.hpp"
+#include "cpu_raytrace/Hittable.hpp"
+
+namespace raytrace2::cpu {
+
+struct Scene;
+
+// Axis aligned box intersected with a single slab test, the nearest of the entry and exit
+// distances in range is the hit. Normals and uvs follow from the axis of the face hit, with the
+// uvs laid out like the faces of MakeBox. Not sampled as a light.
+struct Box final : public Hittable {
+  Box(const vec3& a, const vec3& b, uint32_t material_handle)
+      : min(glm::min(a, b)), max(glm::max(a, b)), aabb(a, b), material_handle(material_handle) {}
+
+  bool Hit(const Scene& scene, const Ray& r, Interval ray_t, RNG& rng,
+           HitRecord& rec) const override;
+  bool Occluded(const Scene& scene, const Ray& r, Interval ray_t, RNG& rng) const override;
+  [[nodiscard]] AABB GetAABB() const override { return aabb; }
+  // distance of the nearest hit in ray_t, without filling a hit record
+  bool Intersect(const Ray& r, Interval ray_t, real& t) const;
+  // fills rec for a hit at distance t along r found by Intersect, the face is found again from
+  // the slab distances
+  void SetHitRecord(const Scene& scene, const Ray& r, real t, HitRecord& rec) const;
+  // only transforms that keep the faces axis aligned keep a box a box
+  [[nodiscard]] std::shared_ptr<Hittable> BakeTransform(const mat4& transform) const override;
+  [[nodiscard]] bool IsConvex() const override { return true; }
+  bool Span(const Ray& r, real& t_enter, real& t_exit) const override;
+
+  vec3 min, max;
+  AABB aabb;
+  uint32_t material_handle;
+
+ private:
+  // entry and exit distances along r and the axes of the faces they cross, false if r misses
+  bool Slabs(const Ray& r, real& t_near, real& t_far, int& near_axis, int& far_axis) const;
+};
+
+}  // namespace raytrace2::cpu
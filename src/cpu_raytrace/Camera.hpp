@@ -5,6 +5,8 @@
 #include "Defs.hpp"
 #include "Math.hpp"
 #include "cpu_raytrace/Ray.hpp"
+#include "cpu_raytrace/Sampler.hpp"
+#include "cpu_raytrace/Sampling.hpp"
 
 namespace raytrace2::cpu {
 class Camera {
@@ -42,29 +44,23 @@ class Camera {
     auto defocus_radius = focus_dist_ * glm::tan(glm::radians(defocus_angle_ / 2));
     defocus_disk_u_ = u * defocus_radius;
     defocus_disk_v_ = v * defocus_radius;
-    sqrt_samples_per_pix_ = static_cast<int>(std::sqrt(samples_per_pixel_));
-    pixel_samples_scale_ = 1.0 / (sqrt_samples_per_pix_ * sqrt_samples_per_pix_);
-    recip_sqrt_samples_per_pix_ = 1.0 / sqrt_samples_per_pix_;
   }
 
-  [[nodiscard]] inline Ray GetRay(int x, int y, int s_i, int s_j) const {
+  // reads the pixel position, lens position and time, kDimensions in all, from the sampler
+  [[nodiscard]] inline Ray GetRay(int x, int y, Sampler& sampler) const {
     assert(!dirty_ && "camera must be updated before getting ray");
-    auto sample_square_stratified = [this](int s_i, int s_j) -> vec2 {
-      auto px = (s_i + math::RandReal()) * recip_sqrt_samples_per_pix_ - 0.5;
-      auto py = (s_j + math::RandReal()) * recip_sqrt_samples_per_pix_ - 0.5;
-      return {px, py};
-    };
-
-    auto offset = sample_square_stratified(s_i, s_j);
+    vec2 offset = sampler.Get2D() - static_cast<real>(0.5);
     auto pixel_center = pixel00_loc_ + ((static_cast<real>(x) + offset.x) * pixel_delta_u_) +
                         ((static_cast<real>(y) + offset.y) * pixel_delta_v_);
-    vec3 center = (defocus_angle_ <= 0) ? center_ : DefocusDiskSample();
+    vec2 lens_u = sampler.Get2D();
+    vec3 center = (defocus_angle_ <= 0) ? center_ : DefocusDiskSample(lens_u);
     // assuming time starts at 0 and ends at 1, randomly sample a time between
-    real ray_time = math::RandReal();
+    real ray_time = sampler.Get1D();
     return Ray{
         .origin = center, .direction = glm::normalize(pixel_center - center), .time = ray_time};
     // return Ray{.origin = center, .direction = pixel_center - center, .time = ray_time};
   }
+  static constexpr uint32_t kDimensions = 5;
 
   inline void SetCenter(const vec3& center) {
     center_ = center;
@@ -107,7 +103,6 @@ class Camera {
 
   [[nodiscard]] inline real GetFOV() const { return vfov_; }
   [[nodiscard]] inline const glm::ivec2& GetDims() const { return dims_; }
-  [[nodiscard]] inline int SqrtSamplesPerPixel() const { return sqrt_samples_per_pix_; }
   [[nodiscard]] inline int SamplesPerPixel() const { return samples_per_pixel_; }
 
   vec3 center_{0, 0, 0};
@@ -125,13 +120,10 @@ class Camera {
 
  private:
   bool dirty_{true};
-  int sqrt_samples_per_pix_;
-  real recip_sqrt_samples_per_pix_;
-  real pixel_samples_scale_;
   int samples_per_pixel_{1};
 
-  [[nodiscard]] vec3 DefocusDiskSample() const {
-    auto p = math::RandInUnitDisk();
+  [[nodiscard]] vec3 DefocusDiskSample(vec2 u) const {
+    vec2 p = sampling::SampleUniformDiskConcentric(u);
     return center_ + (p[0] * defocus_disk_u_) + (p[1] * defocus_disk_v_);
   }
 };
@@ -2,7 +2,7 @@
 
 #include "cpu_raytrace/HitRecord.hpp"
 #include "cpu_raytrace/Interval.hpp"
-#include "cpu_raytrace/Math.hpp"
+#include "cpu_raytrace/RNG.hpp"
 #include "cpu_raytrace/Scene.hpp"
 
 namespace raytrace2::cpu {
@@ -11,41 +11,63 @@ ConstantMedium::ConstantMedium(const std::shared_ptr<Hittable>& boundary, real d
                                uint32_t material_handle)
     : boundary_(boundary), neg_inv_density_(-1.0 / density), material_handle_(material_handle) {}
 
-bool ConstantMedium::Hit(const Scene& scene, const Ray& r, Interval ray_t, HitRecord& rec) const {
-  HitRecord rec1, rec2;
+std::shared_ptr<Hittable> ConstantMedium::BakeTransform(const mat4& transform) const {
+  auto boundary = boundary_->BakeTransform(transform);
+  if (!boundary) return nullptr;
+  auto medium = std::make_shared<ConstantMedium>(*this);
+  medium->boundary_ = boundary;
+  return medium;
+}
+
+bool BoundarySpan(const Scene& scene, const Hittable& boundary, const Ray& r, RNG& rng,
+                  real& t_enter, real& t_exit) {
+  if (boundary.IsConvex()) return boundary.Span(r, t_enter, t_exit);
 
+  HitRecord rec1, rec2;
   // if no intersection at all return false
-  if (!boundary_->Hit(scene, r, Interval::kUniverse, rec1)) {
+  if (!boundary.Hit(scene, r, Interval::kUniverse, rng, rec1)) {
     return false;
   }
 
   // if no second instersection return false
-  if (!boundary_->Hit(scene, r, Interval(rec1.t + 0.0001, kInfinity), rec2)) {
+  if (!boundary.Hit(scene, r, Interval(rec1.t + 0.0001, kInfinity), rng, rec2)) {
     return false;
   }
+  t_enter = rec1.t;
+  t_exit = rec2.t;
+  return true;
+}
 
-  rec1.t = std::fmax(rec1.t, ray_t.min);
-  rec2.t = std::fmin(rec2.t, ray_t.max);
+bool ConstantMedium::SampleScatter(const Scene& scene, const Ray& r, Interval ray_t, RNG& rng,
+                                   real& t) const {
+  real t_enter, t_exit;
+  if (!BoundarySpan(scene, *boundary_, r, rng, t_enter, t_exit)) return false;
 
-  // if (rec1.t < ray_t.min) rec1.t = ray_t.min;
-  // if (rec2.t > ray_t.max) rec2.t = ray_t.max;
+  t_enter = std::fmax(t_enter, ray_t.min);
+  t_exit = std::fmin(t_exit, ray_t.max);
 
   // invalid intersection case
-  if (rec1.t >= rec2.t) {
+  if (t_enter >= t_exit) {
     return false;
   }
 
-  rec1.t = std::fmax(rec1.t, 0);
+  t_enter = std::fmax(t_enter, 0);
 
   real ray_len = glm::length(r.direction);
-  auto dist_inside_boundary = (rec2.t - rec1.t) * ray_len;
-  auto hit_dist = neg_inv_density_ * std::log(math::RandReal());
+  auto dist_inside_boundary = (t_exit - t_enter) * ray_len;
+  auto hit_dist = neg_inv_density_ * std::log(1 - rng.Uniform());
 
   if (hit_dist > dist_inside_boundary) {
     return false;
   }
 
-  rec.t = rec1.t + hit_dist / ray_len;
+  t = t_enter + hit_dist / ray_len;
+  return true;
+}
+
+bool ConstantMedium::Hit(const Scene& scene, const Ray& r, Interval ray_t, RNG& rng,
+                         HitRecord& rec) const {
+  if (!SampleScatter(scene, r, ray_t, rng, rec.t)) return false;
   rec.point = r.At(rec.t);
 
   // both arbitrary
@@ -57,4 +79,9 @@ bool ConstantMedium::Hit(const Scene& scene, const Ray& r, Interval ray_t, HitRe
   return true;
 }
 
+bool ConstantMedium::Occluded(const Scene& scene, const Ray& r, Interval ray_t, RNG& rng) const {
+  real t;
+  return SampleScatter(scene, r, ray_t, rng, t);
+}
+
 }  // namespace raytrace2::cpu
@@ -2,14 +2,30 @@
 
 #include "cpu_raytrace/Hittable.hpp"
 namespace raytrace2::cpu {
+
+// Distances at which the line through r enters and leaves the boundary of a medium. Convex
+// boundaries answer with one Span query, others with two closest hit queries. False if r misses.
+bool BoundarySpan(const Scene& scene, const Hittable& boundary, const Ray& r, RNG& rng,
+                  real& t_enter, real& t_exit);
+
 struct ConstantMedium : public Hittable {
   ConstantMedium() = default;
   ConstantMedium(const std::shared_ptr<Hittable>& boundary, real density, uint32_t material_handle);
-  bool Hit(const Scene& scene, const Ray& r, Interval ray_t, HitRecord& rec) const override;
+  bool Hit(const Scene& scene, const Ray& r, Interval ray_t, RNG& rng,
+           HitRecord& rec) const override;
+  bool Occluded(const Scene& scene, const Ray& r, Interval ray_t, RNG& rng) const override;
 
   [[nodiscard]] AABB GetAABB() const override { return boundary_->GetAABB(); };
+  [[nodiscard]] AABB GetTransformedAABB(const mat4& transform) const override {
+    return boundary_->GetTransformedAABB(transform);
+  }
+  // density stays per world space unit, so scaling the boundary does not scale it
+  [[nodiscard]] std::shared_ptr<Hittable> BakeTransform(const mat4& transform) const override;
 
  private:
+  // samples a scattering distance inside the boundary, false if the ray passes through
+  bool SampleScatter(const Scene& scene, const Ray& r, Interval ray_t, RNG& rng, real& t) const;
+
   std::shared_ptr<Hittable> boundary_;
   real neg_inv_density_;
   uint32_t material_handle_;
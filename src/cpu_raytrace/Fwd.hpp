@@ -2,6 +2,8 @@
 
 namespace raytrace2::cpu {
 
+struct Hittable;
+
 // TODO: material namespace
 struct MaterialMetal;
 struct MaterialLambertian;
@@ -0,0 +1,183 @@
+#include "HeterogeneousMedium.hpp"
+
+#include <tbb/parallel_for.h>
+
+#include "cpu_raytrace/ConstantMedium.hpp"
+#include "cpu_raytrace/HitRecord.hpp"
+#include "cpu_raytrace/Interval.hpp"
+#include "cpu_raytrace/PerlinNoiseGen.hpp"
+#include "cpu_raytrace/RNG.hpp"
+#include "cpu_raytrace/Scene.hpp"
+
+namespace raytrace2::cpu {
+
+DensityGrid::DensityGrid(glm::ivec3 resolution, std::vector<real> values, const AABB& bounds)
+    : resolution(resolution), values(std::move(values)), bounds(bounds) {
+  EASSERT(resolution.x >= 2 && resolution.y >= 2 && resolution.z >= 2);
+  EASSERT(this->values.size() == static_cast<size_t>(resolution.x) * resolution.y * resolution.z);
+}
+
+DensityGrid DensityGrid::FromNoise(const PerlinNoiseGen& noise, real scale, glm::ivec3 resolution,
+                                   const AABB& bounds) {
+  std::vector<real> values(static_cast<size_t>(resolution.x) * resolution.y * resolution.z);
+  vec3 min = bounds.GetMin();
+  vec3 spacing = (bounds.GetMax() - min) / vec3(resolution - 1);
+  tbb::parallel_for(0, resolution.z, [&](int z) {
+    for (int y = 0; y < resolution.y; y++) {
+      for (int x = 0; x < resolution.x; x++) {
+        vec3 p = min + vec3{x, y, z} * spacing;
+        values[(static_cast<size_t>(z) * resolution.y + y) * resolution.x + x] =
+            noise.Turb(scale * p);
+      }
+    }
+  });
+  return {resolution, std::move(values), bounds};
+}
+
+real DensityGrid::Lookup(const vec3& p) const {
+  vec3 min = bounds.GetMin();
+  vec3 g = (p - min) / (bounds.GetMax() - min) * vec3(resolution - 1);
+  g = glm::min(glm::max(g, vec3{0}), vec3(resolution - 1));
+  glm::ivec3 i = glm::min(glm::ivec3(g), resolution - 2);
+  vec3 f = g - vec3(i);
+  real accum = 0;
+  for (int dz = 0; dz < 2; dz++) {
+    for (int dy = 0; dy < 2; dy++) {
+      for (int dx = 0; dx < 2; dx++) {
+        accum += (dx ? f.x : 1 - f.x) * (dy ? f.y : 1 - f.y) * (dz ? f.z : 1 - f.z) *
+                 Value(i.x + dx, i.y + dy, i.z + dz);
+      }
+    }
+  }
+  return accum;
+}
+
+HeterogeneousMedium::HeterogeneousMedium(const std::shared_ptr<Hittable>& boundary,
+                                         DensityGrid density, real density_scale,
+                                         uint32_t material_handle)
+    : boundary_(boundary), density_(std::move(density)), material_handle_(material_handle) {
+  EASSERT(boundary_->IsConvex());
+  for (real& value : density_.values) value = std::fmax(value * density_scale, 0);
+
+  // trilinear interpolation stays within the vertices around a point, so the largest vertex
+  // touching a cell bounds the density in it
+  glm::ivec3 num_cells = density_.resolution - 1;
+  majorant_resolution_ = glm::min(num_cells, glm::ivec3{kMaxMajorantResolution});
+  majorants_.assign(static_cast<size_t>(majorant_resolution_.x) * majorant_resolution_.y *
+                        majorant_resolution_.z,
+                    0);
+  vec3 cells_per_majorant = vec3(num_cells) / vec3(majorant_resolution_);
+  size_t idx = 0;
+  for (int z = 0; z < majorant_resolution_.z; z++) {
+    for (int y = 0; y < majorant_resolution_.y; y++) {
+      for (int x = 0; x < majorant_resolution_.x; x++) {
+        vec3 cell{x, y, z};
+        glm::ivec3 first = glm::floor(cell * cells_per_majorant);
+        glm::ivec3 last =
+            glm::min(glm::ivec3(glm::ceil((cell + 1.f) * cells_per_majorant)), num_cells);
+        real majorant = 0;
+        for (int vz = first.z; vz <= last.z; vz++) {
+          for (int vy = first.y; vy <= last.y; vy++) {
+            for (int vx = first.x; vx <= last.x; vx++) {
+              majorant = std::fmax(majorant, density_.Value(vx, vy, vz));
+            }
+          }
+        }
+        majorants_[idx++] = majorant;
+      }
+    }
+  }
+}
+
+bool HeterogeneousMedium::SampleScatter(const Scene& scene, const Ray& r, Interval ray_t,
+                                        RNG& rng, real& t) const {
+  real t_enter, t_exit;
+  if (!BoundarySpan(scene, *boundary_, r, rng, t_enter, t_exit)) return false;
+  real t_min = std::fmax(std::fmax(t_enter, ray_t.min), 0);
+  real t_max = std::fmin(t_exit, ray_t.max);
+
+  // the ray in units of majorant cells, clipped to the grid, outside of which there is no
+  // density. An axis the ray doesn't move along gives NaN or infinite distances, which fmin
+  // and fmax skip or keep as they should.
+  vec3 min = density_.bounds.GetMin();
+  vec3 cell_size = (density_.bounds.GetMax() - min) / vec3(majorant_resolution_);
+  vec3 origin = (r.origin - min) / cell_size;
+  vec3 dir = r.direction / cell_size;
+  for (int i = 0; i < 3; i++) {
+    real inv_dir = 1 / dir[i];
+    real t0 = -origin[i] * inv_dir;
+    real t1 = (static_cast<real>(majorant_resolution_[i]) - origin[i]) * inv_dir;
+    if (inv_dir < 0) std::swap(t0, t1);
+    t_min = std::fmax(t_min, t0);
+    t_max = std::fmin(t_max, t1);
+  }
+  if (t_min >= t_max) return false;
+
+  // walk the cells along the ray
+  vec3 p = origin + t_min * dir;
+  glm::ivec3 cell =
+      glm::min(glm::max(glm::ivec3(glm::floor(p)), glm::ivec3{0}), majorant_resolution_ - 1);
+  glm::ivec3 step;
+  vec3 next_t, delta_t;
+  for (int i = 0; i < 3; i++) {
+    if (dir[i] == 0) {
+      step[i] = 0;
+      next_t[i] = delta_t[i] = kInfinity;
+      continue;
+    }
+    step[i] = dir[i] > 0 ? 1 : -1;
+    next_t[i] = t_min + (static_cast<real>(cell[i] + (dir[i] > 0)) - p[i]) / dir[i];
+    delta_t[i] = std::abs(1 / dir[i]);
+  }
+
+  real ray_len = glm::length(r.direction);
+  t = t_min;
+  while (true) {
+    int axis = next_t.x < next_t.y ? (next_t.x < next_t.z ? 0 : 2) : (next_t.y < next_t.z ? 1 : 2);
+    real t_end = std::fmin(next_t[axis], t_max);
+    real majorant = Majorant(cell);
+    if (majorant > 0) {
+      // delta tracking, the distance to the next proposed collision is exponential in the
+      // majorant and restarts at the cell boundary when it passes it
+      while (true) {
+        t -= std::log(1 - rng.Uniform()) / (majorant * ray_len);
+        if (t >= t_end) break;
+        // a real collision with probability density / majorant, otherwise a null one
+        if (rng.Uniform() * majorant < density_.Lookup(r.At(t))) return true;
+      }
+    }
+    if (t_end >= t_max) return false;
+    t = t_end;
+    cell[axis] += step[axis];
+    if (cell[axis] < 0 || cell[axis] >= majorant_resolution_[axis]) return false;
+    next_t[axis] += delta_t[axis];
+  }
+}
+
+bool HeterogeneousMedium::Hit(const Scene& scene, const Ray& r, Interval ray_t, RNG& rng,
+                              HitRecord& rec) const {
+  // tracking moves t along before it knows whether there is a hit, and misses leave rec alone
+  real t;
+  if (!SampleScatter(scene, r, ray_t, rng, t)) return false;
+  rec.t = t;
+  rec.point = r.At(rec.t);
+
+  // both arbitrary
+  rec.normal = vec3{1, 0, 0};
+  rec.front_face = true;
+
+  rec.material = &scene.materials[material_handle_];
+  rec.object = nullptr;
+
+  return true;
+}
+
+bool HeterogeneousMedium::Occluded(const Scene& scene, const Ray& r, Interval ray_t,
+                                   RNG& rng) const {
+  // any real collision blocks the ray. Ratio tracking would estimate the transmittance with
+  // less variance, but visibility here is a yes or no.
+  real t;
+  return SampleScatter(scene, r, ray_t, rng, t);
+}
+
+}  // namespace raytrace2::cpu
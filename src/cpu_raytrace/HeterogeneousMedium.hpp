@@ -0,0 +1,69 @@
+#pragma once
+
+#include <glm/ext/vector_int3.hpp>
+
+#include "cpu_raytrace/AABB.hpp"
+#include "cpu_raytrace/Hittable.hpp"
+
+namespace raytrace2::cpu {
+
+class PerlinNoiseGen;
+
+// Density samples on a regular grid of vertices spanning bounds, trilinearly interpolated
+// between them. Values are stored x fastest, then y, then z.
+struct DensityGrid {
+  DensityGrid() = default;
+  DensityGrid(glm::ivec3 resolution, std::vector<real> values, const AABB& bounds);
+  // samples the turbulence of noise at scale times the point, so the majorants of a
+  // HeterogeneousMedium bound it exactly
+  static DensityGrid FromNoise(const PerlinNoiseGen& noise, real scale, glm::ivec3 resolution,
+                               const AABB& bounds);
+
+  [[nodiscard]] real Lookup(const vec3& p) const;
+  [[nodiscard]] real Value(int x, int y, int z) const {
+    return values[(static_cast<size_t>(z) * resolution.y + y) * resolution.x + x];
+  }
+
+  glm::ivec3 resolution{0};
+  std::vector<real> values;
+  AABB bounds;
+};
+
+// Participating medium whose density varies inside its boundary, which has to be convex.
+// Scattering distances are sampled with delta tracking. Each cell of a coarse grid over the
+// density bounds stores the largest density in it, and the ray steps through the cells it
+// crosses, proposing collisions at that rate and keeping each with the ratio of the density
+// there to it. Transforms apply to the boundary and the grid alike, so it can't bake them.
+struct HeterogeneousMedium : public Hittable {
+  static constexpr int kMaxMajorantResolution = 16;
+
+  // the density at each point is density_scale times the grid's
+  HeterogeneousMedium(const std::shared_ptr<Hittable>& boundary, DensityGrid density,
+                      real density_scale, uint32_t material_handle);
+  bool Hit(const Scene& scene, const Ray& r, Interval ray_t, RNG& rng,
+           HitRecord& rec) const override;
+  bool Occluded(const Scene& scene, const Ray& r, Interval ray_t, RNG& rng) const override;
+
+  [[nodiscard]] AABB GetAABB() const override { return boundary_->GetAABB(); };
+  [[nodiscard]] AABB GetTransformedAABB(const mat4& transform) const override {
+    return boundary_->GetTransformedAABB(transform);
+  }
+
+ private:
+  // samples a scattering distance inside the boundary, false if the ray passes through
+  bool SampleScatter(const Scene& scene, const Ray& r, Interval ray_t, RNG& rng, real& t) const;
+  [[nodiscard]] real Majorant(const glm::ivec3& cell) const {
+    return majorants_[(static_cast<size_t>(cell.z) * majorant_resolution_.y + cell.y) *
+                          majorant_resolution_.x +
+                      cell.x];
+  }
+
+  std::shared_ptr<Hittable> boundary_;
+  // with the density scale applied
+  DensityGrid density_;
+  glm::ivec3 majorant_resolution_;
+  std::vector<real> majorants_;
+  uint32_t material_handle_;
+};
+
+}  // namespace raytrace2::cpu
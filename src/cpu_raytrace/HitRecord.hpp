@@ -12,6 +12,8 @@ struct HitRecord {
   vec2 uv;
   real t;
   const MaterialVariant* material{};
+  // primitive that was hit, set by the shapes that can be sampled as lights
+  const Hittable* object{};
   bool front_face;
 
   inline void SetFaceNormal(const Ray& r, const vec3& outward_normal) {
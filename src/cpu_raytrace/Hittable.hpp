@@ -7,11 +7,65 @@ struct Scene;
 struct Ray;
 struct Interval;
 struct HitRecord;
+class RNG;
+struct LightBounds;
+
+struct LightSample {
+  vec3 point;
+  // on the side that emits towards the reference point
+  vec3 normal;
+  vec2 uv;
+  // with respect to solid angle at the reference point
+  real pdf;
+  uint32_t material_handle;
+};
 
 struct Hittable {
+  static constexpr uint32_t kNotALight = UINT32_MAX;
+
   virtual ~Hittable() = default;
-  virtual bool Hit(const Scene& scene, const Ray& r, Interval ray_t, HitRecord& rec) const = 0;
+  // rng supplies the random numbers of shapes that intersect stochastically, like media. rec is
+  // only written on a hit.
+  virtual bool Hit(const Scene& scene, const Ray& r, Interval ray_t, RNG& rng,
+                   HitRecord& rec) const = 0;
+  // any-hit visibility query, returns at the first hit in ray_t without filling a hit record
+  virtual bool Occluded(const Scene& scene, const Ray& r, Interval ray_t, RNG& rng) const = 0;
   [[nodiscard]] virtual AABB GetAABB() const = 0;
+  // world space bounds after applying transform, shapes override this to bound tighter than
+  // the transformed box
+  [[nodiscard]] virtual AABB GetTransformedAABB(const mat4& transform) const {
+    return GetAABB().Transformed(transform);
+  }
+  // copy with transform applied to its world space geometry, nullptr when the transformed shape
+  // can't be represented by the same type and has to stay an instance
+  [[nodiscard]] virtual std::shared_ptr<Hittable> BakeTransform(const mat4& /*transform*/) const {
+    return nullptr;
+  }
+  // whether Span is implemented, which only makes sense for convex shapes
+  [[nodiscard]] virtual bool IsConvex() const { return false; }
+  // distances at which the whole line through r enters and leaves the shape, false if it misses.
+  // Media find their extent along a ray with it in one query.
+  virtual bool Span(const Ray& /*r*/, real& /*t_enter*/, real& /*t_exit*/) const {
+    return false;
+  }
+  // samples a point on the surface for direct lighting of ref from the uniform sample u, false
+  // if the shape can't be sampled or the sample can't reach ref
+  virtual bool SampleLight(const vec3& /*ref*/, vec2 /*u*/, real /*time*/,
+                           LightSample& /*sample*/) const {
+    return false;
+  }
+  // solid angle density of SampleLight picking point on the surface when sampling from ref
+  [[nodiscard]] virtual real LightPDF(const vec3& /*ref*/, const vec3& /*point*/,
+                                      real /*time*/) const {
+    return 0;
+  }
+  // bounds of the shape's position, emitted power and emission directions for building the
+  // light hierarchy, false if the shape can't be sampled as a light
+  virtual bool GetLightBounds(const Scene& /*scene*/, LightBounds& /*light_bounds*/) const {
+    return false;
+  }
+  // index in Scene::lights, kept by copies of the shape, kNotALight if it isn't sampled
+  [[nodiscard]] virtual uint32_t LightIndex() const { return kNotALight; }
 };
 
 }  // namespace raytrace2::cpu
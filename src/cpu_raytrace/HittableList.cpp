@@ -2,23 +2,46 @@
 
 #include "cpu_raytrace/HitRecord.hpp"
 #include "cpu_raytrace/Scene.hpp"
+#include "cpu_raytrace/Transform.hpp"
 
 namespace raytrace2::cpu {
 
-bool HittableList::Hit(const Scene& scene, const cpu::Ray& r, cpu::Interval ray_t,
+bool HittableList::Hit(const Scene& scene, const cpu::Ray& r, cpu::Interval ray_t, RNG& rng,
                        cpu::HitRecord& rec) const {
-  cpu::HitRecord temp_rec;
+  // lists can share a BVH leaf with other primitives, so cull on the list bounds first
+  if (!aabb_.Hit(r, ray_t)) return false;
   bool hit_any = false;
 
+  // misses leave rec alone, so each closer hit can overwrite it in place
   for (const auto& hittable : objects) {
-    bool hit = hittable->Hit(scene, r, ray_t, temp_rec);
-    if (hit) {
+    if (hittable->Hit(scene, r, ray_t, rng, rec)) {
       hit_any = true;
-      ray_t.max = temp_rec.t;
-      rec = temp_rec;
+      ray_t.max = rec.t;
     }
   }
   return hit_any;
 }
 
+AABB HittableList::GetTransformedAABB(const mat4& transform) const {
+  AABB aabb;
+  for (const auto& hittable : objects) aabb = AABB{aabb, hittable->GetTransformedAABB(transform)};
+  return aabb;
+}
+
+std::shared_ptr<Hittable> HittableList::BakeTransform(const mat4& transform) const {
+  auto list = std::make_shared<HittableList>();
+  for (const auto& hittable : objects) {
+    auto baked = hittable->BakeTransform(transform);
+    list->Add(baked ? baked : std::make_shared<TransformedHittable>(hittable, transform));
+  }
+  return list;
+}
+
+bool HittableList::Occluded(const Scene& scene, const cpu::Ray& r, cpu::Interval ray_t,
+                            RNG& rng) const {
+  if (!aabb_.Hit(r, ray_t)) return false;
+  return std::ranges::any_of(
+      objects, [&](const auto& hittable) { return hittable->Occluded(scene, r, ray_t, rng); });
+}
+
 }  // namespace raytrace2::cpu
@@ -14,9 +14,14 @@ struct HittableList : public Hittable {
     objects.emplace_back(object);
     aabb_ = AABB{aabb_, object->GetAABB()};
   }
-  bool Hit(const Scene& scene, const cpu::Ray& r, cpu::Interval ray_t,
+  bool Hit(const Scene& scene, const cpu::Ray& r, cpu::Interval ray_t, RNG& rng,
            cpu::HitRecord& rec) const override;
+  bool Occluded(const Scene& scene, const cpu::Ray& r, cpu::Interval ray_t,
+                RNG& rng) const override;
   [[nodiscard]] AABB GetAABB() const override { return aabb_; }
+  [[nodiscard]] AABB GetTransformedAABB(const mat4& transform) const override;
+  // bakes each child, instancing the ones that can't be baked
+  [[nodiscard]] std::shared_ptr<Hittable> BakeTransform(const mat4& transform) const override;
 
  private:
   AABB aabb_;
@@ -0,0 +1,265 @@
+#include "LightBVH.hpp"
+
+#include "cpu_raytrace/Hittable.hpp"
+#include "cpu_raytrace/Material.hpp"
+#include "cpu_raytrace/Scene.hpp"
+
+namespace raytrace2::cpu {
+
+namespace {
+
+constexpr real kPi = std::numbers::pi_v<real>;
+
+real SafeSqrt(real x) { return std::sqrt(std::max(static_cast<real>(0), x)); }
+real SafeACos(real x) {
+  return std::acos(std::clamp(x, static_cast<real>(-1), static_cast<real>(1)));
+}
+
+// cos(max(0, theta_a - theta_b)) and sin(max(0, theta_a - theta_b))
+real CosSubClamped(real sin_a, real cos_a, real sin_b, real cos_b) {
+  if (cos_a > cos_b) return 1;
+  return cos_a * cos_b + sin_a * sin_b;
+}
+real SinSubClamped(real sin_a, real cos_a, real sin_b, real cos_b) {
+  if (cos_a > cos_b) return 0;
+  return sin_a * cos_b - cos_a * sin_b;
+}
+
+// rotates v by angle around the unit axis (Rodrigues)
+vec3 Rotate(const vec3& v, const vec3& axis, real angle) {
+  real cos_angle = std::cos(angle), sin_angle = std::sin(angle);
+  return v * cos_angle + glm::cross(axis, v) * sin_angle +
+         axis * glm::dot(axis, v) * (1 - cos_angle);
+}
+
+// smallest cone around both cones, given by their axes and the cosines of their spreads
+void UnionCones(const vec3& w_a, real cos_a, const vec3& w_b, real cos_b, vec3& w, real& cos) {
+  real theta_a = SafeACos(cos_a), theta_b = SafeACos(cos_b);
+  real theta_d = SafeACos(glm::dot(w_a, w_b));
+  if (std::min(theta_d + theta_b, kPi) <= theta_a) {
+    w = w_a, cos = cos_a;
+    return;
+  }
+  if (std::min(theta_d + theta_a, kPi) <= theta_b) {
+    w = w_b, cos = cos_b;
+    return;
+  }
+  // spread of the merged cone, and how far its axis turns from w_a towards w_b
+  real theta_o = (theta_a + theta_d + theta_b) / 2;
+  vec3 axis = glm::cross(w_a, w_b);
+  real axis_length = glm::length(axis);
+  if (theta_o >= kPi || axis_length == 0) {
+    w = w_a, cos = -1;
+    return;
+  }
+  w = glm::normalize(Rotate(w_a, axis / axis_length, theta_o - theta_a));
+  cos = std::cos(theta_o);
+}
+
+// Cost of a split side from PBRT 4th ed. 12.6.3: power times the solid angle measure of the
+// emission cone times surface area, stretched for bounds that are thin along the split axis.
+real EvaluateCost(const LightBounds& b, const AABB& bounds, int axis) {
+  real theta_o = SafeACos(b.cos_theta_o), theta_e = SafeACos(b.cos_theta_e);
+  real theta_w = std::min(theta_o + theta_e, kPi);
+  real sin_theta_o = SafeSqrt(1 - b.cos_theta_o * b.cos_theta_o);
+  real m_omega = 2 * kPi * (1 - b.cos_theta_o) +
+                 kPi / 2 *
+                     (2 * theta_w * sin_theta_o - std::cos(theta_o - 2 * theta_w) -
+                      2 * theta_o * sin_theta_o + b.cos_theta_o);
+  vec3 diagonal = bounds.GetMax() - bounds.GetMin();
+  real kr = std::max({diagonal.x, diagonal.y, diagonal.z}) / diagonal[axis];
+  return b.phi * m_omega * kr * b.bounds.SurfaceArea();
+}
+
+}  // namespace
+
+real EmittedRadiance(const Scene& scene, uint32_t material_handle, const vec2& uv,
+                     const vec3& p) {
+  const auto* light = std::get_if<DiffuseLight>(&scene.materials[material_handle]);
+  if (!light) return 0;
+  vec3 emission = light->Emit(scene.textures, uv, p);
+  return std::max({emission.x, emission.y, emission.z});
+}
+
+real LightBounds::Importance(const vec3& p, const vec3& n) const {
+  vec3 pc = bounds.Centroid();
+  vec3 diagonal = bounds.GetMax() - bounds.GetMin();
+  vec3 to_p = p - pc;
+  // clamp the distance so points inside the bounds don't blow up
+  real dist_sq = std::max(glm::dot(to_p, to_p), glm::length(diagonal) / 2);
+
+  vec3 wi = to_p / std::sqrt(std::max(glm::dot(to_p, to_p), static_cast<real>(1e-12)));
+  real cos_theta_w = glm::dot(w, wi);
+  if (two_sided) cos_theta_w = std::abs(cos_theta_w);
+  real sin_theta_w = SafeSqrt(1 - cos_theta_w * cos_theta_w);
+
+  // half angle of the cone of directions from p that the bounds subtend
+  real radius_sq = glm::dot(diagonal, diagonal) / 4;
+  real cos_theta_b = -1;
+  if (glm::dot(to_p, to_p) > radius_sq) {
+    cos_theta_b = SafeSqrt(1 - radius_sq / glm::dot(to_p, to_p));
+  }
+  real sin_theta_b = SafeSqrt(1 - cos_theta_b * cos_theta_b);
+
+  // smallest angle between the direction to p and any emitter normal, minus the bounds' spread
+  real sin_theta_o = SafeSqrt(1 - cos_theta_o * cos_theta_o);
+  real cos_theta_x = CosSubClamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+  real sin_theta_x = SinSubClamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+  real cos_theta_p = CosSubClamped(sin_theta_x, cos_theta_x, sin_theta_b, cos_theta_b);
+  if (cos_theta_p <= cos_theta_e) return 0;
+
+  real importance = phi * cos_theta_p / dist_sq;
+  if (n != vec3{0}) {
+    // smallest incident angle at p over the directions to the bounds
+    real cos_theta_i = std::abs(glm::dot(wi, n));
+    real sin_theta_i = SafeSqrt(1 - cos_theta_i * cos_theta_i);
+    importance *= CosSubClamped(sin_theta_i, cos_theta_i, sin_theta_b, cos_theta_b);
+  }
+  return std::max(importance, static_cast<real>(0));
+}
+
+LightBounds Union(const LightBounds& a, const LightBounds& b) {
+  if (a.phi == 0) return b;
+  if (b.phi == 0) return a;
+  LightBounds result;
+  result.bounds = AABB{a.bounds, b.bounds};
+  UnionCones(a.w, a.cos_theta_o, b.w, b.cos_theta_o, result.w, result.cos_theta_o);
+  result.phi = a.phi + b.phi;
+  result.cos_theta_e = std::min(a.cos_theta_e, b.cos_theta_e);
+  result.two_sided = a.two_sided || b.two_sided;
+  return result;
+}
+
+LightBVH::LightBVH(const std::vector<std::shared_ptr<Hittable>>& lights, const Scene& scene) {
+  std::vector<BuildLight> build_lights;
+  for (uint32_t i = 0; i < lights.size(); i++) {
+    LightBounds light_bounds;
+    if (lights[i]->GetLightBounds(scene, light_bounds) && light_bounds.phi > 0) {
+      build_lights.push_back({.light_bounds = light_bounds, .light_idx = i});
+    }
+  }
+  if (build_lights.empty()) return;
+  nodes_.reserve(2 * build_lights.size() - 1);
+  light_bit_trails_.resize(lights.size());
+  Build(build_lights, 0, 0);
+}
+
+void LightBVH::Build(std::span<BuildLight> build_lights, uint64_t bit_trail, size_t depth) {
+  if (build_lights.size() == 1) {
+    nodes_.push_back({.light_bounds = build_lights[0].light_bounds,
+                      .child_or_light_idx = build_lights[0].light_idx,
+                      .is_leaf = true});
+    light_bit_trails_[build_lights[0].light_idx] = bit_trail;
+    return;
+  }
+
+  LightBounds node_bounds;
+  vec3 centroid_min{kInfinity}, centroid_max{-kInfinity};
+  for (const auto& build_light : build_lights) {
+    node_bounds = Union(node_bounds, build_light.light_bounds);
+    vec3 centroid = build_light.light_bounds.bounds.Centroid();
+    centroid_min = glm::min(centroid_min, centroid);
+    centroid_max = glm::max(centroid_max, centroid);
+  }
+
+  // pick the cheapest bucket boundary over all three axes
+  real min_cost = kInfinity;
+  int min_cost_axis = -1;
+  size_t min_cost_bucket = 0;
+  auto bucket_of = [&](const BuildLight& build_light, int axis) {
+    real offset = (build_light.light_bounds.bounds.Centroid()[axis] - centroid_min[axis]) /
+                  (centroid_max[axis] - centroid_min[axis]);
+    return std::min(static_cast<size_t>(offset * kNumBuckets), kNumBuckets - 1);
+  };
+  // past half the depth limit, split by count so the bit trails can't overflow
+  if (depth < kMaxDepth / 2) {
+    for (int axis = 0; axis < 3; axis++) {
+      if (centroid_max[axis] <= centroid_min[axis]) continue;
+      LightBounds buckets[kNumBuckets];
+      for (const auto& build_light : build_lights) {
+        size_t b = bucket_of(build_light, axis);
+        buckets[b] = Union(buckets[b], build_light.light_bounds);
+      }
+      for (size_t split = 0; split < kNumBuckets - 1; split++) {
+        LightBounds below, above;
+        for (size_t b = 0; b <= split; b++) below = Union(below, buckets[b]);
+        for (size_t b = split + 1; b < kNumBuckets; b++) above = Union(above, buckets[b]);
+        real cost = EvaluateCost(below, node_bounds.bounds, axis) +
+                    EvaluateCost(above, node_bounds.bounds, axis);
+        if (cost > 0 && cost < min_cost) {
+          min_cost = cost;
+          min_cost_axis = axis;
+          min_cost_bucket = split;
+        }
+      }
+    }
+  }
+
+  size_t mid = build_lights.size() / 2;
+  if (min_cost_axis != -1) {
+    auto it = std::partition(build_lights.begin(), build_lights.end(),
+                             [&](const BuildLight& build_light) {
+                               return bucket_of(build_light, min_cost_axis) <= min_cost_bucket;
+                             });
+    size_t split = it - build_lights.begin();
+    if (split != 0 && split != build_lights.size()) mid = split;
+  }
+
+  uint32_t node_idx = nodes_.size();
+  nodes_.push_back({.light_bounds = node_bounds, .child_or_light_idx = 0, .is_leaf = false});
+  Build(build_lights.subspan(0, mid), bit_trail, depth + 1);
+  nodes_[node_idx].child_or_light_idx = nodes_.size();
+  Build(build_lights.subspan(mid), bit_trail | (uint64_t{1} << depth), depth + 1);
+}
+
+bool LightBVH::Sample(const vec3& p, const vec3& n, real u, uint32_t& light_idx,
+                      real& pmf) const {
+  if (nodes_.empty()) return false;
+  uint32_t node_idx = 0;
+  pmf = 1;
+  while (true) {
+    const Node& node = nodes_[node_idx];
+    if (node.is_leaf) {
+      // a single light at the root hasn't been checked against p yet
+      if (node_idx == 0 && node.light_bounds.Importance(p, n) == 0) return false;
+      light_idx = node.child_or_light_idx;
+      return true;
+    }
+    real importance_0 = nodes_[node_idx + 1].light_bounds.Importance(p, n);
+    real importance_1 = nodes_[node.child_or_light_idx].light_bounds.Importance(p, n);
+    if (importance_0 == 0 && importance_1 == 0) return false;
+    real p_0 = importance_0 / (importance_0 + importance_1);
+    // reuse u for the next level by remapping the chosen part of [0, 1) back onto it
+    if (u < p_0) {
+      node_idx = node_idx + 1;
+      u = std::min(u / p_0, static_cast<real>(0x1.fffffep-1));
+      pmf *= p_0;
+    } else {
+      node_idx = node.child_or_light_idx;
+      u = std::min((u - p_0) / (1 - p_0), static_cast<real>(0x1.fffffep-1));
+      pmf *= 1 - p_0;
+    }
+  }
+}
+
+real LightBVH::PMF(const vec3& p, const vec3& n, uint32_t light_idx) const {
+  if (light_idx >= light_bit_trails_.size() || !light_bit_trails_[light_idx]) return 0;
+  uint64_t bit_trail = *light_bit_trails_[light_idx];
+  uint32_t node_idx = 0;
+  real pmf = 1;
+  while (!nodes_[node_idx].is_leaf) {
+    const Node& node = nodes_[node_idx];
+    real importance_0 = nodes_[node_idx + 1].light_bounds.Importance(p, n);
+    real importance_1 = nodes_[node.child_or_light_idx].light_bounds.Importance(p, n);
+    bool second = bit_trail & 1;
+    real importance = second ? importance_1 : importance_0;
+    if (importance == 0) return 0;
+    pmf *= importance / (importance_0 + importance_1);
+    node_idx = second ? node.child_or_light_idx : node_idx + 1;
+    bit_trail >>= 1;
+  }
+  if (node_idx == 0 && nodes_[0].light_bounds.Importance(p, n) == 0) return 0;
+  return pmf;
+}
+
+}  // namespace raytrace2::cpu
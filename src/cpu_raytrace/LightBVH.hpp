@@ -0,0 +1,74 @@
+#pragma once
+
+#include "cpu_raytrace/AABB.hpp"
+
+namespace raytrace2::cpu {
+
+struct Scene;
+struct Hittable;
+
+// Conservative summary of a group of emitters: where they are, how much they emit and the cone
+// of directions their surface normals point in. Emission leaves each normal within a further
+// cos_theta_e, which is 0 for diffuse emitters.
+struct LightBounds {
+  AABB bounds;
+  vec3 w{0, 0, 1};
+  real phi{0};
+  real cos_theta_o{1};
+  real cos_theta_e{1};
+  bool two_sided{false};
+
+  // Upper bound style estimate of the light reaching point p on a surface with normal n, n of
+  // zero for points in a medium. Zero only when none of the emitters can reach p.
+  [[nodiscard]] real Importance(const vec3& p, const vec3& n) const;
+};
+
+LightBounds Union(const LightBounds& a, const LightBounds& b);
+
+// largest channel of the emission of material at uv and p, 0 for non emissive materials.
+// Shapes use it at a single point to estimate their power, which is exact for solid colors.
+real EmittedRadiance(const Scene& scene, uint32_t material_handle, const vec2& uv,
+                     const vec3& p);
+
+// Hierarchy over the emitters of a scene used to pick one light per shading point with
+// probability roughly proportional to its contribution there (Conty Estevez and Kulla 2018,
+// as in PBRT 4th ed. 12.6.3). Sampling walks a single root to leaf path, choosing between the
+// two children by their importance, so its cost grows with the log of the light count.
+class LightBVH {
+ public:
+  LightBVH() = default;
+  // lights are indexed as in the given vector, emitters with no power are never picked
+  LightBVH(const std::vector<std::shared_ptr<Hittable>>& lights, const Scene& scene);
+
+  // picks a light for p and n from the uniform sample u, false if no light can reach p
+  bool Sample(const vec3& p, const vec3& n, real u, uint32_t& light_idx, real& pmf) const;
+  // probability that Sample picks the light with index light_idx at p and n
+  [[nodiscard]] real PMF(const vec3& p, const vec3& n, uint32_t light_idx) const;
+
+  [[nodiscard]] bool Empty() const { return nodes_.empty(); }
+  [[nodiscard]] size_t NumNodes() const { return nodes_.size(); }
+
+ private:
+  // flattened depth first, the first child of an interior node directly follows it
+  struct Node {
+    LightBounds light_bounds;
+    uint32_t child_or_light_idx;  // second child offset, or light index for leaves
+    bool is_leaf;
+  };
+  struct BuildLight {
+    LightBounds light_bounds;
+    uint32_t light_idx;
+  };
+
+  static constexpr size_t kNumBuckets = 12;
+  // paths are recorded with one bit per level below the root
+  static constexpr size_t kMaxDepth = 64;
+
+  std::vector<Node> nodes_;
+  // for each light in the tree, the child picked at each level from the root, lowest bit first
+  std::vector<std::optional<uint64_t>> light_bit_trails_;
+
+  void Build(std::span<BuildLight> build_lights, uint64_t bit_trail, size_t depth);
+};
+
+}  // namespace raytrace2::cpu
@@ -3,14 +3,16 @@
 #include "cpu_raytrace/Fwd.hpp"
 #include "cpu_raytrace/HitRecord.hpp"
 #include "cpu_raytrace/Math.hpp"
+#include "cpu_raytrace/Sampler.hpp"
+#include "cpu_raytrace/Sampling.hpp"
 #include "cpu_raytrace/Texture.hpp"
 
 namespace raytrace2::cpu {
 
 bool MaterialMetal::Scatter(const texture::TexArray&, const Ray& r_in, const HitRecord& rec,
-                            vec3& attenuation, Ray& scattered) const {
-  vec3 reflected =
-      glm::normalize(math::Reflect(r_in.direction, rec.normal)) + (fuzz * math::RandUnitVec3());
+                            Sampler& sampler, vec3& attenuation, Ray& scattered) const {
+  vec3 reflected = glm::normalize(math::Reflect(r_in.direction, rec.normal)) +
+                   (fuzz * sampling::SampleUniformSphere(sampler.Get2D()));
   scattered = Ray{.origin = rec.point, .direction = reflected, .time = r_in.time};
   attenuation = albedo;
   return true;
@@ -27,7 +29,7 @@ auto SchlickReflectance(auto cosine, auto refraction_index) {
 }  // namespace
 
 bool MaterialDielectric::Scatter(const texture::TexArray&, const Ray& r_in, const HitRecord& rec,
-                                 vec3& attenuation, Ray& scattered) const {
+                                 Sampler& sampler, vec3& attenuation, Ray& scattered) const {
   attenuation = vec3(1.0f);
   real ri = rec.front_face ? (1.0 / refraction_index) : refraction_index;
   vec3 unit_dir = glm::normalize(r_in.direction);
@@ -35,7 +37,7 @@ bool MaterialDielectric::Scatter(const texture::TexArray&, const Ray& r_in, cons
   real sin_theta = glm::sqrt(1.f - cos_theta * cos_theta);
   bool cannot_refract = ri * sin_theta > 1.0;
   vec3 direction;
-  if (cannot_refract || SchlickReflectance(cos_theta, ri) > math::RandReal()) {
+  if (cannot_refract || SchlickReflectance(cos_theta, ri) > sampler.Get1D()) {
     direction = math::Reflect(unit_dir, rec.normal);
   } else {
     direction = math::Refract(unit_dir, rec.normal, ri);
@@ -45,22 +47,27 @@ bool MaterialDielectric::Scatter(const texture::TexArray&, const Ray& r_in, cons
 }
 
 bool MaterialLambertian::Scatter(const texture::TexArray&, const Ray& r_in, const HitRecord& rec,
-                                 vec3& attenuation, Ray& scattered) const {
-  vec3 scattered_dir = rec.normal + math::RandUnitVec3();
-  if (math::NearZero(scattered_dir)) {
-    scattered_dir = rec.normal;
-  }
+                                 Sampler& sampler, vec3& attenuation, Ray& scattered) const {
+  vec3 scattered_dir = sampling::SampleCosineHemisphere(rec.normal, sampler.Get2D());
   scattered = Ray{.origin = rec.point, .direction = scattered_dir, .time = r_in.time};
   attenuation = albedo;
   return true;
 }
 
+vec3 MaterialLambertian::Eval(const texture::TexArray&, const HitRecord& rec,
+                              const vec3& wi) const {
+  return albedo * std::max(glm::dot(rec.normal, wi), static_cast<real>(0)) *
+         std::numbers::inv_pi_v<real>;
+}
+
+real MaterialLambertian::PDF(const HitRecord& rec, const vec3& wi) const {
+  return sampling::CosineHemispherePDF(glm::dot(rec.normal, wi));
+}
+
 bool MaterialTexture::Scatter(const texture::TexArray& tex_arr, const Ray& r_in,
-                              const HitRecord& rec, vec3& attenuation, Ray& scattered) const {
-  vec3 scattered_dir = rec.normal + math::RandUnitVec3();
-  if (math::NearZero(scattered_dir)) {
-    scattered_dir = rec.normal;
-  }
+                              const HitRecord& rec, Sampler& sampler, vec3& attenuation,
+                              Ray& scattered) const {
+  vec3 scattered_dir = sampling::SampleCosineHemisphere(rec.normal, sampler.Get2D());
   scattered = Ray{.origin = rec.point, .direction = scattered_dir, .time = r_in.time};
   attenuation = std::visit(
       [&rec, &tex_arr](auto&& tex) -> vec3 { return tex.Value(tex_arr, rec.uv, rec.point); },
@@ -68,18 +75,45 @@ bool MaterialTexture::Scatter(const texture::TexArray& tex_arr, const Ray& r_in,
   return true;
 }
 
+vec3 MaterialTexture::Eval(const texture::TexArray& tex_arr, const HitRecord& rec,
+                           const vec3& wi) const {
+  vec3 albedo = std::visit(
+      [&rec, &tex_arr](auto&& tex) -> vec3 { return tex.Value(tex_arr, rec.uv, rec.point); },
+      tex_arr[tex_idx]);
+  return albedo * std::max(glm::dot(rec.normal, wi), static_cast<real>(0)) *
+         std::numbers::inv_pi_v<real>;
+}
+
+real MaterialTexture::PDF(const HitRecord& rec, const vec3& wi) const {
+  return sampling::CosineHemispherePDF(glm::dot(rec.normal, wi));
+}
+
 vec3 DiffuseLight::Emit(const texture::TexArray& tex_arr, const vec2& uv, const vec3& p) const {
   return std::visit([&tex_arr, &uv, &p](auto&& tex) -> vec3 { return tex.Value(tex_arr, uv, p); },
                     tex_arr[tex_idx]);
 }
 
 bool MaterialIsotropic::Scatter(const texture::TexArray& tex_arr, const Ray& r_in,
-                                const HitRecord& rec, vec3& attenuation, Ray& scattered) const {
-  scattered = Ray(rec.point, math::RandUnitVec3(), r_in.time);
+                                const HitRecord& rec, Sampler& sampler, vec3& attenuation,
+                                Ray& scattered) const {
+  scattered = Ray(rec.point, sampling::SampleUniformSphere(sampler.Get2D()), r_in.time);
   attenuation = std::visit(
       [&rec, &tex_arr](auto&& tex) -> vec3 { return tex.Value(tex_arr, rec.uv, rec.point); },
       tex_arr[tex_idx]);
   return true;
 }
 
+vec3 MaterialIsotropic::Eval(const texture::TexArray& tex_arr, const HitRecord& rec,
+                             const vec3&) const {
+  // the phase function is uniform over the sphere and there is no cosine term in a medium
+  vec3 albedo = std::visit(
+      [&rec, &tex_arr](auto&& tex) -> vec3 { return tex.Value(tex_arr, rec.uv, rec.point); },
+      tex_arr[tex_idx]);
+  return albedo * (static_cast<real>(0.25) * std::numbers::inv_pi_v<real>);
+}
+
+real MaterialIsotropic::PDF(const HitRecord&, const vec3&) const {
+  return static_cast<real>(0.25) * std::numbers::inv_pi_v<real>;
+}
+
 }  // namespace raytrace2::cpu
@@ -6,19 +6,48 @@ namespace raytrace2::cpu {
 
 struct HitRecord;
 struct Ray;
+class Sampler;
 
-enum class MaterialType { kScattering, kEmissive };
+// diffuse materials scatter like kScattering ones but can also evaluate their BSDF for a given
+// direction, which direct light sampling needs
+enum class MaterialType { kScattering, kDiffuse, kEmissive };
 
 template <typename T, MaterialType Type = MaterialType::kScattering>
 struct Material {
   bool Scatter(const texture::TexArray& tex_arr, const Ray& r_in, const HitRecord& rec,
-               vec3& attenuation, Ray& scattered) const {
-    if constexpr (Type == MaterialType::kScattering) {
-      return static_cast<const T*>(this)->Scatter(tex_arr, r_in, rec, attenuation, scattered);
+               Sampler& sampler, vec3& attenuation, Ray& scattered) const {
+    if constexpr (Type != MaterialType::kEmissive) {
+      return static_cast<const T*>(this)->Scatter(tex_arr, r_in, rec, sampler, attenuation,
+                                                  scattered);
     }
     return false;
   }
 
+  [[nodiscard]] static constexpr bool IsDiffuse() { return Type == MaterialType::kDiffuse; }
+  // only textures read the uv of a hit, shapes skip computing it for other materials
+  [[nodiscard]] static constexpr bool SamplesTexture() {
+    return requires(const T& material) { material.tex_idx; };
+  }
+
+  // solid angle density with which Scatter picks unit direction wi
+  [[nodiscard]] real PDF(const HitRecord& rec, const vec3& wi) const {
+    if constexpr (Type == MaterialType::kDiffuse) {
+      return static_cast<const T*>(this)->PDF(rec, wi);
+    } else {
+      return 0;
+    }
+  }
+
+  // BSDF times the cosine with the normal for light arriving from unit direction wi
+  [[nodiscard]] vec3 Eval(const texture::TexArray& tex_arr, const HitRecord& rec,
+                          const vec3& wi) const {
+    if constexpr (Type == MaterialType::kDiffuse) {
+      return static_cast<const T*>(this)->Eval(tex_arr, rec, wi);
+    } else {
+      return vec3{0};
+    }
+  }
+
   [[nodiscard]] vec3 Emit(const texture::TexArray& tex_arr, const vec2& uv, const vec3& p) const {
     if constexpr (Type == MaterialType::kEmissive) {
       return static_cast<const T*>(this)->Emit(tex_arr, uv, p);
@@ -32,18 +61,21 @@ struct alignas(16) MaterialMetal : public Material<MaterialMetal> {
   vec3 albedo;
   real fuzz{0};
   bool Scatter(const texture::TexArray& tex_arr, const Ray& r_in, const HitRecord& rec,
-               vec3& attenuation, Ray& scattered) const;
+               Sampler& sampler, vec3& attenuation, Ray& scattered) const;
 };
 
 struct alignas(16) MaterialDielectric : public Material<MaterialMetal> {
   real refraction_index;
   bool Scatter(const texture::TexArray& tex_arr, const Ray& r_in, const HitRecord& rec,
-               vec3& attenuation, Ray& scattered) const;
+               Sampler& sampler, vec3& attenuation, Ray& scattered) const;
 };
 
-struct alignas(16) MaterialTexture : public Material<MaterialTexture> {
+struct alignas(16) MaterialTexture : public Material<MaterialTexture, MaterialType::kDiffuse> {
   bool Scatter(const texture::TexArray& tex_arr, const Ray& r_in, const HitRecord& rec,
-               vec3& attenuation, Ray& scattered) const;
+               Sampler& sampler, vec3& attenuation, Ray& scattered) const;
+  [[nodiscard]] vec3 Eval(const texture::TexArray& tex_arr, const HitRecord& rec,
+                          const vec3& wi) const;
+  [[nodiscard]] real PDF(const HitRecord& rec, const vec3& wi) const;
   uint32_t tex_idx{};
 };
 
@@ -52,16 +84,27 @@ struct DiffuseLight : public Material<DiffuseLight, MaterialType::kEmissive> {
   [[nodiscard]] vec3 Emit(const texture::TexArray& tex_arr, const vec2& uv, const vec3& p) const;
 };
 
-struct alignas(16) MaterialLambertian : public Material<MaterialLambertian> {
+struct alignas(16) MaterialLambertian
+    : public Material<MaterialLambertian, MaterialType::kDiffuse> {
   vec3 albedo;
   bool Scatter(const texture::TexArray& tex_arr, const Ray& r_in, const HitRecord& rec,
-               vec3& attenuation, Ray& scattered) const;
+               Sampler& sampler, vec3& attenuation, Ray& scattered) const;
+  [[nodiscard]] vec3 Eval(const texture::TexArray& tex_arr, const HitRecord& rec,
+                          const vec3& wi) const;
+  [[nodiscard]] real PDF(const HitRecord& rec, const vec3& wi) const;
 };
 
-struct MaterialIsotropic : public Material<MaterialIsotropic, MaterialType::kScattering> {
+struct MaterialIsotropic : public Material<MaterialIsotropic, MaterialType::kDiffuse> {
   uint32_t tex_idx{};
   bool Scatter(const texture::TexArray& tex_arr, const Ray& r_in, const HitRecord& rec,
-               vec3& attenuation, Ray& scattered) const;
+               Sampler& sampler, vec3& attenuation, Ray& scattered) const;
+  [[nodiscard]] vec3 Eval(const texture::TexArray& tex_arr, const HitRecord& rec,
+                          const vec3& wi) const;
+  [[nodiscard]] real PDF(const HitRecord& rec, const vec3& wi) const;
 };
 
+inline bool SamplesTexture(const MaterialVariant& material) {
+  return std::visit([](auto&& m) { return m.SamplesTexture(); }, material);
+}
+
 }  // namespace raytrace2::cpu
@@ -0,0 +1,54 @@
+#include "Mesh.hpp"
+
+#include "cpu_raytrace/HitRecord.hpp"
+#include "cpu_raytrace/Scene.hpp"
+
+namespace raytrace2::cpu {
+
+TriangleMesh::TriangleMesh(std::shared_ptr<const MeshData> data, uint32_t material_handle,
+                           const BVHBuildSettings& settings)
+    : data(std::move(data)),
+      material_handle(material_handle),
+      bvh_(std::make_unique<BVH>(*this, settings)) {}
+
+bool TriangleMesh::Hit(const Scene& scene, const Ray& r, Interval ray_t, RNG& rng,
+                       HitRecord& rec) const {
+  return bvh_->Hit(scene, r, ray_t, rng, rec);
+}
+
+bool TriangleMesh::Occluded(const Scene& scene, const Ray& r, Interval ray_t, RNG& rng) const {
+  return bvh_->Occluded(scene, r, ray_t, rng);
+}
+
+void TriangleMesh::SetHitRecord(const Scene& scene, const Ray& r, uint32_t triangle, real t,
+                                vec2 barycentric, HitRecord& rec) const {
+  const vec3& p0 = data->Position(triangle, 0);
+  real b0 = 1 - barycentric.x - barycentric.y;
+  rec.t = t;
+  rec.point = r.At(t);
+  rec.material = &scene.materials[material_handle];
+  rec.object = nullptr;
+  rec.SetFaceNormal(r, glm::normalize(glm::cross(data->Position(triangle, 1) - p0,
+                                                 data->Position(triangle, 2) - p0)));
+  if (!data->normals.empty()) {
+    const uint32_t* idx = &data->normal_indices[3 * triangle];
+    vec3 shading_normal = b0 * data->normals[idx[0]] + barycentric.x * data->normals[idx[1]] +
+                          barycentric.y * data->normals[idx[2]];
+    real length = glm::length(shading_normal);
+    // keep the side of the geometric normal, which decides front_face
+    if (length > 0) {
+      shading_normal /= length;
+      rec.normal = glm::dot(shading_normal, rec.normal) < 0 ? -shading_normal : shading_normal;
+    }
+  }
+  if (!SamplesTexture(*rec.material)) return;
+  if (!data->uvs.empty()) {
+    const uint32_t* idx = &data->uv_indices[3 * triangle];
+    rec.uv = b0 * data->uvs[idx[0]] + barycentric.x * data->uvs[idx[1]] +
+             barycentric.y * data->uvs[idx[2]];
+  } else {
+    rec.uv = barycentric;
+  }
+}
+
+}  // namespace raytrace2::cpu
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "Defs.hpp"
+#include "cpu_raytrace/BVH.hpp"
+#include "cpu_raytrace/Hittable.hpp"
+#include "cpu_raytrace/Triangle.hpp"
+
+namespace raytrace2::cpu {
+
+struct Scene;
+
+// Triangles indexing shared vertex arrays, with a BVH of their own so the scene sees the mesh as
+// a single primitive. Transformed copies become instances sharing the arrays and the BVH rather
+// than baking every vertex. Not sampled as a light.
+struct TriangleMesh : public Hittable {
+  TriangleMesh(std::shared_ptr<const MeshData> data, uint32_t material_handle,
+               const BVHBuildSettings& settings = {});
+  // the BVH refers back to the mesh
+  TriangleMesh(const TriangleMesh&) = delete;
+  TriangleMesh& operator=(const TriangleMesh&) = delete;
+
+  bool Hit(const Scene& scene, const Ray& r, Interval ray_t, RNG& rng,
+           HitRecord& rec) const override;
+  bool Occluded(const Scene& scene, const Ray& r, Interval ray_t, RNG& rng) const override;
+  [[nodiscard]] AABB GetAABB() const override { return bvh_->GetAABB(); }
+  [[nodiscard]] AABB GetTransformedAABB(const mat4& transform) const override {
+    return bvh_->GetTransformedAABB(transform);
+  }
+  // fills rec for a hit on triangle at distance t along r, interpolating the vertex normals and
+  // uvs where the mesh has them. The uvs are left out for materials without a texture.
+  void SetHitRecord(const Scene& scene, const Ray& r, uint32_t triangle, real t,
+                    vec2 barycentric, HitRecord& rec) const;
+
+  std::shared_ptr<const MeshData> data;
+  uint32_t material_handle;
+
+ private:
+  std::unique_ptr<BVH> bvh_;
+};
+
+}  // namespace raytrace2::cpu
@@ -1,11 +1,14 @@
 #include "PerlinNoiseGen.hpp"
 
-#include "cpu_raytrace/Math.hpp"
+#include "cpu_raytrace/RNG.hpp"
+#include "cpu_raytrace/Sampling.hpp"
 
 namespace raytrace2::cpu {
 
-PerlinNoiseGen::PerlinNoiseGen(int point_count) : point_count_(point_count) { Init(); }
-PerlinNoiseGen::PerlinNoiseGen() { Init(); }
+PerlinNoiseGen::PerlinNoiseGen(int point_count, uint32_t seed) : point_count_(point_count) {
+  Init(seed);
+}
+PerlinNoiseGen::PerlinNoiseGen() { Init(0); }
 
 real PerlinInterp(vec3 c[2][2][2], real u, real v, real w) {
   real uu = u * u * (3 - 2 * u);
@@ -38,15 +41,16 @@ real TrilinearInterp(real c[2][2][2], real u, real v, real w) {
   return accum;
 }
 
-void PerlinNoiseGen::Init() {
+void PerlinNoiseGen::Init(uint32_t seed) {
+  RNG rng{seed};
   rand_vec3_.resize(point_count_);
   for (int i = 0; i < point_count_; i++) {
-    rand_vec3_[i] = glm::normalize(math::RandVec3(-1, 1));
+    rand_vec3_[i] = sampling::SampleUniformSphere(rng.Uniform2D());
   }
 
-  GeneratePerm(perm_x_);
-  GeneratePerm(perm_y_);
-  GeneratePerm(perm_z_);
+  GeneratePerm(perm_x_, rng);
+  GeneratePerm(perm_y_, rng);
+  GeneratePerm(perm_z_, rng);
 }
 
 real PerlinNoiseGen::Turb(const vec3& p) const { return Turb(p, 7); }
@@ -87,7 +91,7 @@ real PerlinNoiseGen::Noise(const vec3& p) const {
   return PerlinInterp(c, u, v, w);
 }
 
-void PerlinNoiseGen::GeneratePerm(std::vector<int>& perm) const {
+void PerlinNoiseGen::GeneratePerm(std::vector<int>& perm, RNG& rng) const {
   perm.clear();
   perm.reserve(point_count_);
   for (int i = 0; i < point_count_; i++) {
@@ -95,7 +99,7 @@ void PerlinNoiseGen::GeneratePerm(std::vector<int>& perm) const {
   }
 
   for (int i = point_count_ - 1; i > 0; i--) {
-    int target = math::RandInt(0, i);
+    auto target = static_cast<int>(rng.UniformUInt(i + 1));
     int tmp = perm[i];
     perm[i] = perm[target];
     perm[target] = tmp;
@@ -3,9 +3,12 @@
 #include "Defs.hpp"
 namespace raytrace2::cpu {
 
+class RNG;
+
 class PerlinNoiseGen {
  public:
-  explicit PerlinNoiseGen(int point_count);
+  // the same seed gives the same noise
+  explicit PerlinNoiseGen(int point_count, uint32_t seed = 0);
   PerlinNoiseGen();
   [[nodiscard]] real Noise(const vec3& p) const;
   [[nodiscard]] real Turb(const vec3& p, int depth) const;
@@ -19,8 +22,8 @@ class PerlinNoiseGen {
   // std::vector<real> randreal_;
   int point_count_{256};
 
-  void GeneratePerm(std::vector<int>& perm) const;
-  void Init();
+  void GeneratePerm(std::vector<int>& perm, RNG& rng) const;
+  void Init(uint32_t seed);
 };
 
 }  // namespace raytrace2::cpu
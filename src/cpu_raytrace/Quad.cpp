@@ -2,43 +2,125 @@
 
 #include "cpu_raytrace/HitRecord.hpp"
 #include "cpu_raytrace/Interval.hpp"
+#include "cpu_raytrace/LightBVH.hpp"
+#include "cpu_raytrace/Sampling.hpp"
 #include "cpu_raytrace/Scene.hpp"
 
 namespace raytrace2::cpu {
-bool IsInterior(real a, real b, HitRecord& rec) {
-  Interval unit_interval{0, 1};
-
-  // given the hit point in the plane coordinates, not interior if it's outside
-  // the primitive, otherwise set the hit uv coords and return true
-  if (!unit_interval.Contains(a) || !unit_interval.Contains(b)) return false;
 
-  rec.uv = {a, b};
-  return true;
-}
+namespace {
 
-bool Quad::Hit(const Scene& scene, const Ray& r, Interval ray_t, HitRecord& rec) const {
-  real n_dot_raydir = glm::dot(normal, r.direction);
+// intersects the plane of the quad, writing the hit t and the hit point in plane coordinates
+bool IntersectPlane(const Quad& quad, const Ray& r, Interval ray_t, real& t, real& alpha,
+                    real& beta) {
+  real n_dot_raydir = glm::dot(quad.normal, r.direction);
 
   // no hit if ray parallel to plane
   if (std::fabs(n_dot_raydir) < 1e-8) return false;
 
   // no hit if hit point t outside ray interval
-  real t = (d - glm::dot(normal, r.origin)) / n_dot_raydir;
+  t = (quad.d - glm::dot(quad.normal, r.origin)) / n_dot_raydir;
   if (!ray_t.Contains(t)) return false;
 
-  // determine if hit point lies within planer shape using its plane coords
-  vec3 intersection_pt = r.At(t);
-  vec3 planar_hitpt_vector = intersection_pt - q;
-  real alpha = glm::dot(w, glm::cross(planar_hitpt_vector, v));
-  real beta = glm::dot(w, glm::cross(u, planar_hitpt_vector));
+  // plane coords of the hit point
+  vec3 planar_hitpt_vector = r.At(t) - quad.q;
+  alpha = glm::dot(quad.w, glm::cross(planar_hitpt_vector, quad.v));
+  beta = glm::dot(quad.w, glm::cross(quad.u, planar_hitpt_vector));
+  return true;
+}
 
-  if (!IsInterior(alpha, beta, rec)) return false;
+}  // namespace
 
+bool Quad::Hit(const Scene& scene, const Ray& r, Interval ray_t, RNG&, HitRecord& rec) const {
+  real t;
+  vec2 uv;
+  if (!Intersect(r, ray_t, t, uv)) return false;
+  SetHitRecord(scene, r, t, uv, rec);
+  return true;
+}
+
+bool Quad::Intersect(const Ray& r, Interval ray_t, real& t, vec2& uv) const {
+  if (!IntersectPlane(*this, r, ray_t, t, uv.x, uv.y)) return false;
+  // determine if hit point lies within planer shape using its plane coords
+  Interval unit_interval{0, 1};
+  return unit_interval.Contains(uv.x) && unit_interval.Contains(uv.y);
+}
+
+void Quad::SetHitRecord(const Scene& scene, const Ray& r, real t, vec2 uv, HitRecord& rec) const {
   rec.t = t;
-  rec.point = intersection_pt;
+  rec.point = r.At(t);
+  rec.uv = uv;
   rec.material = &scene.materials[material_handle];
+  rec.object = this;
   rec.SetFaceNormal(r, normal);
+}
 
+AABB Quad::GetTransformedAABB(const mat4& transform) const {
+  auto apply = [&](const vec3& p) { return vec3(transform * vec4(p, 1)); };
+  return AABB{AABB{apply(q), apply(q + u + v)}, AABB{apply(q + u), apply(q + v)}};
+}
+
+namespace {
+
+// solid angle sampling loses precision on quads that look tiny or cover nearly the whole
+// hemisphere, those are sampled by area (bounds from PBRT 4th ed. 6.5.4)
+bool UseSolidAngleSampling(real solid_angle) {
+  return solid_angle > static_cast<real>(3e-4) && solid_angle < static_cast<real>(6.22);
+}
+
+// the area density 1 / area converted to solid angle at ref
+real AreaSamplingPDF(const Quad& quad, const vec3& ref, const vec3& point) {
+  vec3 to_light = point - ref;
+  real dist_sq = glm::dot(to_light, to_light);
+  real cos_light = std::abs(glm::dot(quad.normal, to_light)) / std::sqrt(dist_sq);
+  if (cos_light < 1e-6) return 0;
+  return dist_sq / (cos_light * glm::length(glm::cross(quad.u, quad.v)));
+}
+
+}  // namespace
+
+bool Quad::SampleLight(const vec3& ref, vec2 sample_u, real, LightSample& sample) const {
+  real solid_angle = sampling::QuadSolidAngle(q, u, v, ref);
+  if (UseSolidAngleSampling(solid_angle)) {
+    sample.point = sampling::SampleQuadSolidAngle(q, u, v, ref, sample_u);
+    sample.pdf = 1 / solid_angle;
+    vec3 planar_pt_vector = sample.point - q;
+    sample.uv = {glm::dot(w, glm::cross(planar_pt_vector, v)),
+                 glm::dot(w, glm::cross(u, planar_pt_vector))};
+  } else {
+    sample.point = q + sample_u.x * u + sample_u.y * v;
+    sample.pdf = AreaSamplingPDF(*this, ref, sample.point);
+    if (sample.pdf == 0) return false;
+    sample.uv = sample_u;
+  }
+  sample.normal = glm::dot(normal, sample.point - ref) > 0 ? -normal : normal;
+  sample.material_handle = material_handle;
   return true;
 }
+
+real Quad::LightPDF(const vec3& ref, const vec3& point, real) const {
+  real solid_angle = sampling::QuadSolidAngle(q, u, v, ref);
+  if (UseSolidAngleSampling(solid_angle)) return 1 / solid_angle;
+  return AreaSamplingPDF(*this, ref, point);
+}
+
+bool Quad::GetLightBounds(const Scene& scene, LightBounds& light_bounds) const {
+  real area = glm::length(glm::cross(u, v));
+  // emits from both faces
+  vec3 center = q + (u + v) * static_cast<real>(0.5);
+  light_bounds.phi = 2 * std::numbers::pi_v<real> * area *
+                     EmittedRadiance(scene, material_handle, vec2{0.5}, center);
+  light_bounds.bounds = aabb;
+  light_bounds.w = normal;
+  light_bounds.cos_theta_o = 1;
+  light_bounds.cos_theta_e = 0;
+  light_bounds.two_sided = true;
+  return true;
+}
+
+bool Quad::Occluded(const Scene&, const Ray& r, Interval ray_t, RNG&) const {
+  real t;
+  vec2 uv;
+  return Intersect(r, ray_t, t, uv);
+}
 }  // namespace raytrace2::cpu
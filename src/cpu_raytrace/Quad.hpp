@@ -10,7 +10,7 @@ namespace raytrace2::cpu {
 
 struct Scene;
 
-struct Quad : public Hittable {
+struct Quad final : public Hittable {
   Quad(const vec3& q, const vec3& u, const vec3& v, uint32_t material_handle)
       : q(q), u(u), v(v), material_handle(material_handle) {
     auto n = glm::cross(u, v);
@@ -20,8 +20,26 @@ struct Quad : public Hittable {
     SetBoundingBox();
   }
 
-  bool Hit(const Scene& scene, const Ray& r, Interval ray_t, HitRecord& rec) const override;
+  bool Hit(const Scene& scene, const Ray& r, Interval ray_t, RNG& rng,
+           HitRecord& rec) const override;
+  bool Occluded(const Scene& scene, const Ray& r, Interval ray_t, RNG& rng) const override;
   [[nodiscard]] AABB GetAABB() const override { return aabb; };
+  [[nodiscard]] AABB GetTransformedAABB(const mat4& transform) const override;
+  // uniform over the solid angle seen from ref, or over the area when that is imprecise
+  bool SampleLight(const vec3& ref, vec2 u, real time, LightSample& sample) const override;
+  [[nodiscard]] real LightPDF(const vec3& ref, const vec3& point, real time) const override;
+  bool GetLightBounds(const Scene& scene, LightBounds& light_bounds) const override;
+  [[nodiscard]] uint32_t LightIndex() const override { return light_idx; }
+  // distance of the hit in ray_t and its plane coordinates, which are also its uv
+  bool Intersect(const Ray& r, Interval ray_t, real& t, vec2& uv) const;
+  // fills rec for a hit at distance t along r
+  void SetHitRecord(const Scene& scene, const Ray& r, real t, vec2 uv, HitRecord& rec) const;
+  [[nodiscard]] std::shared_ptr<Hittable> BakeTransform(const mat4& transform) const override {
+    // affine maps take parallelograms to parallelograms
+    mat3 linear{transform};
+    return std::make_shared<Quad>(vec3(transform * vec4(q, 1)), linear * u, linear * v,
+                                  material_handle);
+  }
 
   void SetBoundingBox() { aabb = AABB{AABB{q, q + u + v}, AABB{q + u, q + v}}; }
 
@@ -29,6 +47,7 @@ struct Quad : public Hittable {
   vec3 q, u, v, w, normal;
   real d;
   uint32_t material_handle;
+  uint32_t light_idx{kNotALight};
 };
 
 inline HittableList MakeBox(const vec3& a, const vec3& b, uint32_t material_handle) {
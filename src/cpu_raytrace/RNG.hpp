@@ -0,0 +1,47 @@
+#pragma once
+
+#include "Defs.hpp"
+
+namespace raytrace2::cpu {
+
+// SplitMix64 finalizer, every input bit affects every output bit
+inline uint64_t MixBits(uint64_t z) {
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+// top 24 bits as a float in [0, 1), which holds them exactly so the result stays below 1
+inline real BitsToUniform(uint32_t bits) { return static_cast<real>(bits >> 8) * 0x1p-24f; }
+
+// Counter based random numbers. Each draw hashes (seed, pixel, sample index, dimension)
+// instead of stepping a sequential state, so what a pixel sees depends only on those and not on
+// which thread renders it or in what order. The hash is the SplitMix64 finalizer applied to a
+// Weyl sequence over the dimension, keyed by the hashed seed, pixel and sample index. Every draw
+// moves on to the next dimension.
+class RNG {
+ public:
+  RNG() = default;
+  explicit RNG(uint32_t seed, uint32_t pixel = 0, uint32_t sample = 0, uint32_t dimension = 0)
+      : key_(MixBits(MixBits((static_cast<uint64_t>(seed) << 32) | pixel) ^ sample)),
+        dimension_(dimension) {}
+
+  // uniform in [0, 1)
+  real Uniform() { return BitsToUniform(static_cast<uint32_t>(Next() >> 32)); }
+  // two independent uniforms in [0, 1) from a single dimension
+  vec2 Uniform2D() {
+    uint64_t bits = Next();
+    return {BitsToUniform(static_cast<uint32_t>(bits >> 32)),
+            BitsToUniform(static_cast<uint32_t>(bits))};
+  }
+  // uniform in [0, n)
+  uint32_t UniformUInt(uint32_t n) { return static_cast<uint32_t>(((Next() >> 32) * n) >> 32); }
+
+ private:
+  uint64_t key_{0};
+  uint32_t dimension_{0};
+
+  uint64_t Next() { return MixBits(key_ + 0x9e3779b97f4a7c15ull * (dimension_++ + 1ull)); }
+};
+
+}  // namespace raytrace2::cpu
@@ -10,4 +10,17 @@ struct Ray {
   real time;
 };
 
+// Ray as seen by acceleration structures: the reciprocal direction and its signs are computed
+// once per traversal instead of once per box test. Signs are taken from the reciprocal so a -0
+// direction component counts as negative, matching its -inf reciprocal.
+struct TraversalRay {
+  explicit TraversalRay(const Ray& r)
+      : origin(r.origin),
+        inv_dir(static_cast<real>(1) / r.direction),
+        dir_is_neg{inv_dir.x < 0, inv_dir.y < 0, inv_dir.z < 0} {}
+  vec3 origin;
+  vec3 inv_dir;
+  bool dir_is_neg[3];
+};
+
 }  // namespace raytrace2::cpu
@@ -2,11 +2,12 @@
 
 #include <imgui.h>
 
-#include <execution>
-
 #include "cpu_raytrace/Camera.hpp"
 #include "cpu_raytrace/Material.hpp"
 #include "cpu_raytrace/Math.hpp"
+#include "cpu_raytrace/RNG.hpp"
+#include "cpu_raytrace/Sampler.hpp"
+#include "cpu_raytrace/Sampling.hpp"
 #include "cpu_raytrace/Scene.hpp"
 
 namespace raytrace2::cpu {
@@ -17,56 +18,423 @@ color ToColor(const vec3& col) {
   return color{floor(col.x * 255.999), floor(col.y * 255.999), floor(col.z * 255.999), 255};
 }
 
-vec3 RayColor(const cpu::Ray& r, int depth, const Scene& scene) {
-  if (depth <= 0) return {0, 0, 0};
+// weight of a sample drawn with pdf against one other strategy with other_pdf
+real PowerHeuristic(real pdf, real other_pdf) {
+  pdf *= pdf;
+  other_pdf *= other_pdf;
+  return pdf / (pdf + other_pdf);
+}
+
+// normal the light hierarchy weighs incident light by, none for scattering in a medium
+vec3 LightSamplingNormal(const HitRecord& rec) {
+  return std::holds_alternative<MaterialIsotropic>(*rec.material) ? vec3{0} : rec.normal;
+}
+
+// sample dimensions of each bounce: the light pick and the point on it, the scattered
+// direction, and the russian roulette decision
+constexpr uint32_t kLightDimension = 0;
+constexpr uint32_t kScatterDimension = 3;
+constexpr uint32_t kRouletteDimension = 5;
+constexpr uint32_t kBounceDimensions = 6;
+
+// light reflected at rec from one light picked by the light hierarchy, zero if the sample is
+// occluded. With mis the contribution is weighted against the chance of the BSDF sampling the
+// same direction.
+vec3 SampleDirectLight(const Scene& scene, const Ray& r, const HitRecord& rec, bool mis,
+                       Sampler& sampler) {
+  uint32_t light_idx;
+  real light_pmf;
+  real u_light = sampler.Get1D();
+  vec2 u_point = sampler.Get2D();
+  if (!scene.light_bvh.Sample(rec.point, LightSamplingNormal(rec), u_light, light_idx,
+                              light_pmf)) {
+    return vec3{0};
+  }
+  LightSample sample;
+  if (!scene.lights[light_idx]->SampleLight(rec.point, u_point, r.time, sample)) {
+    return vec3{0};
+  }
+  vec3 wi = sample.point - rec.point;
+  real dist = glm::length(wi);
+  wi /= dist;
+  vec3 f = std::visit([&](auto&& material) { return material.Eval(scene.textures, rec, wi); },
+                      *rec.material);
+  if (f == vec3{0}) return vec3{0};
+  // stop short of the light so the shadow ray doesn't hit the light itself
+  Ray shadow_ray{.origin = rec.point, .direction = wi, .time = r.time};
+  if (scene.hittable_list.Occluded(scene, shadow_ray, cpu::Interval{0.001, dist * 0.999f},
+                                  sampler.Rng())) {
+    return vec3{0};
+  }
+  vec3 emission_color = std::visit(
+      [&](auto&& material) { return material.Emit(scene.textures, sample.uv, sample.point); },
+      scene.materials[sample.material_handle]);
+  real light_pdf = sample.pdf * light_pmf;
+  real weight = 1;
+  if (mis) {
+    real bsdf_pdf = std::visit([&](auto&& material) { return material.PDF(rec, wi); },
+                               *rec.material);
+    weight = PowerHeuristic(light_pdf, bsdf_pdf);
+  }
+  return f * emission_color * (weight / light_pdf);
+}
+
+// Follows the path for up to max_depth surface interactions, weighting what it picks up by the
+// product of the attenuations so far. Past rr_min_depth, paths survive each bounce with
+// probability equal to their largest throughput component and are reweighted to stay unbiased.
+// With primary_hit, direct light at a diffuse first vertex is left to the caller, which gets
+// the vertex written to primary_hit. Each bounce reads its sample dimensions from its own
+// fixed range after the camera's, so they stay stratified whatever earlier bounces did.
+vec3 RayColor(cpu::Ray r, size_t max_depth, size_t rr_min_depth, LightSampling light_sampling,
+              const Scene& scene, Sampler& sampler, HitRecord* primary_hit = nullptr) {
+  bool sample_lights = light_sampling != LightSampling::kBSDF && !scene.light_bvh.Empty();
+  bool mis = sample_lights && light_sampling == LightSampling::kMIS;
+  vec3 radiance{0};
+  vec3 throughput{1};
+  // the vertex the current ray left from, used to weight the emitters it hits
+  bool prev_diffuse = false;
+  vec3 prev_point, prev_normal;
+  real prev_bsdf_pdf = 0;
+  for (size_t depth = 0; depth < max_depth; depth++) {
+    auto bounce_dimension =
+        static_cast<uint32_t>(Camera::kDimensions + depth * kBounceDimensions);
+    HitRecord rec;
+    if (!scene.hittable_list.Hit(scene, r, cpu::Interval{0.001, kInfinity}, sampler.Rng(),
+                                 rec)) {
+      radiance += throughput * scene.background_color;
+      break;
+    }
+
+    Ray scattered;
+    vec3 attenuation;
+
+    vec3 emission_color = std::visit(
+        [&](auto&& material) { return material.Emit(scene.textures, rec.uv, rec.point); },
+        *rec.material);
+    if (!sample_lights || !prev_diffuse) {
+      radiance += throughput * emission_color;
+    } else if (mis && emission_color != vec3{0}) {
+      // without mis the light sample at the previous vertex already accounted for this emitter
+      uint32_t light_idx = rec.object ? rec.object->LightIndex() : Hittable::kNotALight;
+      real light_pdf = light_idx != Hittable::kNotALight
+                           ? rec.object->LightPDF(prev_point, rec.point, r.time) *
+                                 scene.light_bvh.PMF(prev_point, prev_normal, light_idx)
+                           : 0;
+      radiance += throughput * emission_color * PowerHeuristic(prev_bsdf_pdf, light_pdf);
+    }
 
-  HitRecord rec;
+    bool is_diffuse =
+        std::visit([](auto&& material) { return material.IsDiffuse(); }, *rec.material);
+    if (sample_lights && is_diffuse) {
+      if (depth == 0 && primary_hit) {
+        *primary_hit = rec;
+      } else {
+        sampler.SetDimension(bounce_dimension + kLightDimension);
+        radiance += throughput * SampleDirectLight(scene, r, rec, mis, sampler);
+      }
+    }
 
-  if (!scene.hittable_list.Hit(scene, r, cpu::Interval{0.001, kInfinity}, rec)) {
-    return scene.background_color;
+    sampler.SetDimension(bounce_dimension + kScatterDimension);
+    bool is_scattered = std::visit(
+        [&](auto&& material) {
+          return material.Scatter(scene.textures, r, rec, sampler, attenuation, scattered);
+        },
+        *rec.material);
+    if (!is_scattered) break;
+    throughput *= attenuation;
+    prev_diffuse = is_diffuse;
+    if (mis && is_diffuse) {
+      prev_point = rec.point;
+      prev_normal = LightSamplingNormal(rec);
+      vec3 wi = glm::normalize(scattered.direction);
+      prev_bsdf_pdf =
+          std::visit([&](auto&& material) { return material.PDF(rec, wi); }, *rec.material);
+    }
+
+    if (depth + 1 >= rr_min_depth) {
+      real survival = std::max({throughput.x, throughput.y, throughput.z});
+      if (survival < 1) {
+        sampler.SetDimension(bounce_dimension + kRouletteDimension);
+        if (sampler.Get1D() >= survival) break;
+        throughput /= survival;
+      }
+    }
+    r = scattered;
   }
+  return radiance;
+}
+
+// light candidates per pixel and frame, and how far back in time samples are remembered in
+// multiples of that
+constexpr int kReSTIRCandidates = 4;
+constexpr real kReSTIRMaxHistory = 20;
+// neighbors merged per pixel, picked within a fraction of the larger image dimension
+constexpr int kSpatialNeighbors = 5;
+constexpr real kSpatialRadius = 0.03;
+// first dimension of the spatial pass's random numbers, past any a path uses
+constexpr uint32_t kSpatialReuseDimension = 1u << 24;
+
+// added to the mean luminance an adaptive sampling error is relative to, so near black pixels
+// that are noisy only in relative terms still converge
+constexpr real kAdaptiveErrorOffset = 0.01;
+
+real Luminance(const vec3& c) { return glm::dot(c, vec3{0.2126, 0.7152, 0.0722}); }
+
+// Unshadowed light from a point on a light reflected at rec, per unit light area. Resampling
+// uses the luminance of this as its target function, so samples are shared between pixels in
+// the area measure which doesn't depend on the shading point. Light normals face the side
+// that emits, which keeps points on the far side of a sphere from being reused.
+vec3 UnshadowedContribution(const Scene& scene, const HitRecord& rec, const vec3& light_point,
+                            const vec3& light_normal, const vec3& emission) {
+  vec3 wi = light_point - rec.point;
+  real dist_sq = glm::dot(wi, wi);
+  if (dist_sq == 0) return vec3{0};
+  wi /= std::sqrt(dist_sq);
+  vec3 f = std::visit([&](auto&& material) { return material.Eval(scene.textures, rec, wi); },
+                      *rec.material);
+  return f * emission * (std::max(-glm::dot(light_normal, wi), static_cast<real>(0)) / dist_sq);
+}
 
-  Ray scattered;
-  vec3 attenuation;
+real ReservoirTarget(const Scene& scene, const HitRecord& rec, const Reservoir& reservoir) {
+  if (reservoir.weight_sum == 0) return 0;
+  return Luminance(UnshadowedContribution(scene, rec, reservoir.light_point,
+                                          reservoir.light_normal, reservoir.emission));
+}
 
-  vec3 emission_color =
-      std::visit([&](auto&& material) { return material.Emit(scene.textures, rec.uv, rec.point); },
-                 *rec.material);
+bool Visible(const Scene& scene, const HitRecord& rec, const vec3& light_point, real time,
+             RNG& rng) {
+  vec3 wi = light_point - rec.point;
+  real dist = glm::length(wi);
+  Ray shadow_ray{.origin = rec.point, .direction = wi / dist, .time = time};
+  return !scene.hittable_list.Occluded(scene, shadow_ray, cpu::Interval{0.001, dist * 0.999f},
+                                       rng);
+}
 
-  bool is_scattered = std::visit(
-      [&](auto&& material) {
-        return material.Scatter(scene.textures, r, rec, attenuation, scattered);
-      },
-      *rec.material);
-  if (is_scattered) {
-    return attenuation * RayColor(scattered, depth - 1, scene) + emission_color;
+// resamples kReSTIRCandidates light samples drawn from the light hierarchy down to one
+Reservoir GenerateCandidates(const Scene& scene, const HitRecord& rec, real time, RNG& rng) {
+  Reservoir reservoir;
+  vec3 normal = LightSamplingNormal(rec);
+  for (int i = 0; i < kReSTIRCandidates; i++) {
+    uint32_t light_idx;
+    real light_pmf;
+    LightSample sample;
+    if (!scene.light_bvh.Sample(rec.point, normal, rng.Uniform(), light_idx, light_pmf) ||
+        !scene.lights[light_idx]->SampleLight(rec.point, rng.Uniform2D(), time, sample)) {
+      reservoir.num_candidates += 1;
+      continue;
+    }
+    vec3 le = std::visit(
+        [&](auto&& material) { return material.Emit(scene.textures, sample.uv, sample.point); },
+        scene.materials[sample.material_handle]);
+    // the sampled solid angle density converted to area on the light
+    vec3 wi = sample.point - rec.point;
+    real dist_sq = glm::dot(wi, wi);
+    real cos_light = std::abs(glm::dot(sample.normal, wi)) / std::sqrt(dist_sq);
+    real area_pdf = light_pmf * sample.pdf * cos_light / dist_sq;
+    real target =
+        Luminance(UnshadowedContribution(scene, rec, sample.point, sample.normal, le));
+    reservoir.Update(sample.point, sample.normal, le, area_pdf > 0 ? target / area_pdf : 0,
+                     rng.Uniform());
   }
-  return emission_color;
+  reservoir.Finalize(ReservoirTarget(scene, rec, reservoir));
+  return reservoir;
 }
 
 }  // namespace
 
 void RayTracer::Reset() {
+  size_t num_pixels = static_cast<size_t>(dims_.x) * dims_.y;
   accumulation_data_.clear();
-  accumulation_data_.resize(static_cast<size_t>(dims_.x) * dims_.y);
+  accumulation_data_.resize(num_pixels);
+  sample_counts_.assign(num_pixels, 0);
+  luminance_sq_sums_.assign(num_pixels, 0);
+  active_tiles_ = tiles_;
+  // the reservoirs only carry over between frames of the same view
+  reservoirs_.clear();
+  spatial_reservoirs_.clear();
   frame_idx_ = 0;
 }
 
 void RayTracer::Update(const Scene& scene) {
   camera->Update();
-  int sqrt_samples_per_pix = camera->SqrtSamplesPerPixel();
-  // get s_j and s_i for this frame
-  int s_i = frame_idx_ % sqrt_samples_per_pix;
-  int s_j = frame_idx_ / sqrt_samples_per_pix % sqrt_samples_per_pix;
   frame_idx_++;
-  auto per_pixel = [this, &scene, s_j, s_i](const glm::ivec3& idx) {
-    vec3 ray_color = RayColor(camera->GetRay(idx.x, idx.y, s_i, s_j), max_depth, scene);
-    accumulation_data_[idx.z] += ray_color;
-    pixels_[idx.z] = ToColor(glm::clamp(accumulation_data_[idx.z] / static_cast<real>(frame_idx_),
-                                        static_cast<real>(0.0), static_cast<real>(1.0)));
+  Sampler frame_sampler{sampler_type, seed, static_cast<uint32_t>(camera->SamplesPerPixel()),
+                        dims_};
+  converged_this_update_.assign(active_tiles_.size(), 0);
+  if (light_sampling == LightSampling::kReSTIR && !scene.light_bvh.Empty()) {
+    UpdateReSTIR(scene, frame_sampler);
+  } else {
+    auto per_tile = [this, &scene, &frame_sampler](uint32_t tile_idx, const Tile& tile) {
+      for (int y = tile.min.y; y < tile.max.y; y++) {
+        size_t idx = static_cast<size_t>(y) * dims_.x + tile.min.x;
+        for (int x = tile.min.x; x < tile.max.x; x++, idx++) {
+          Sampler sampler = frame_sampler;
+          sampler.StartPixelSample({x, y}, sample_counts_[idx]);
+          vec3 ray_color = RayColor(camera->GetRay(x, y, sampler), max_depth,
+                                    russian_roulette_min_depth, light_sampling, scene, sampler);
+          AddSample(idx, ray_color);
+        }
+      }
+      CheckConvergence(tile_idx, tile);
+    };
+    scheduler_.Run(active_tiles_, per_tile);
+  }
+  RetireConvergedTiles();
+}
+
+void RayTracer::AddSample(size_t idx, const vec3& color) {
+  accumulation_data_[idx] += color;
+  real luminance = Luminance(color);
+  luminance_sq_sums_[idx] += luminance * luminance;
+  uint32_t n = ++sample_counts_[idx];
+  pixels_[idx] = ToColor(glm::clamp(accumulation_data_[idx] / static_cast<real>(n),
+                                    static_cast<real>(0.0), static_cast<real>(1.0)));
+}
+
+void RayTracer::CheckConvergence(uint32_t tile_idx, const Tile& tile) {
+  if (adaptive_threshold <= 0) return;
+  for (int y = tile.min.y; y < tile.max.y; y++) {
+    size_t idx = static_cast<size_t>(y) * dims_.x + tile.min.x;
+    for (int x = tile.min.x; x < tile.max.x; x++, idx++) {
+      auto n = static_cast<real>(sample_counts_[idx]);
+      if (sample_counts_[idx] < adaptive_min_samples) return;
+      real mean = Luminance(accumulation_data_[idx]) / n;
+      real variance = std::max(luminance_sq_sums_[idx] / n - mean * mean, static_cast<real>(0));
+      if (std::sqrt(variance / n) > adaptive_threshold * (mean + kAdaptiveErrorOffset)) return;
+    }
+  }
+  converged_this_update_[tile_idx] = 1;
+}
+
+void RayTracer::RetireConvergedTiles() {
+  size_t kept = 0;
+  for (size_t i = 0; i < active_tiles_.size(); i++) {
+    if (!converged_this_update_[i]) active_tiles_[kept++] = active_tiles_[i];
+  }
+  active_tiles_.resize(kept);
+}
+
+// Traces every pixel's path first, leaving out direct light at diffuse first vertices, and
+// builds a reservoir there from fresh candidates and the pixel's reservoir of the previous
+// frame. A second pass merges each reservoir with a few similar neighbors and shades with the
+// result. Neighbors are merged without checking visibility to them, which darkens contact
+// shadows slightly in exchange for cheaper reuse (the biased variant of Bitterli et al. 2020).
+// Only active tiles are rendered, converged neighbors lend the reservoirs of their last frame.
+void RayTracer::UpdateReSTIR(const Scene& scene, const Sampler& frame_sampler) {
+  size_t num_pixels = static_cast<size_t>(dims_.x) * dims_.y;
+  bool has_history = true;
+  if (reservoirs_.size() != num_pixels) {
+    primary_vertices_.resize(num_pixels);
+    reservoirs_.assign(num_pixels, {});
+    spatial_reservoirs_.assign(num_pixels, {});
+    has_history = false;
+  }
+
+  auto generate = [&](uint32_t, const Tile& tile) {
+    for (int y = tile.min.y; y < tile.max.y; y++) {
+      size_t idx = static_cast<size_t>(y) * dims_.x + tile.min.x;
+      for (int x = tile.min.x; x < tile.max.x; x++, idx++) {
+        PrimaryVertex& vertex = primary_vertices_[idx];
+        vertex.rec.material = nullptr;
+        Sampler sampler = frame_sampler;
+        sampler.StartPixelSample({x, y}, sample_counts_[idx]);
+        Ray r = camera->GetRay(x, y, sampler);
+        vertex.time = r.time;
+        vertex.path_radiance = RayColor(r, max_depth, russian_roulette_min_depth,
+                                        LightSampling::kNEE, scene, sampler, &vertex.rec);
+        vertex.resample_direct = vertex.rec.material != nullptr;
+        if (!vertex.resample_direct) continue;
+
+        // resampling draws a varying amount of numbers, from outside the sample dimensions
+        RNG& rng = sampler.Rng();
+        Reservoir reservoir = GenerateCandidates(scene, vertex.rec, vertex.time, rng);
+        // drop an occluded pick now so it isn't spread to the neighbors
+        if (reservoir.weight > 0 &&
+            !Visible(scene, vertex.rec, reservoir.light_point, vertex.time, rng)) {
+          reservoir.weight = 0;
+        }
+        const Reservoir& prev = spatial_reservoirs_[idx];
+        if (has_history && sample_counts_[idx] > 0 && prev.num_candidates > 0) {
+          Reservoir temporal;
+          real current_target = ReservoirTarget(scene, vertex.rec, reservoir);
+          temporal.Merge(reservoir, current_target, rng.Uniform());
+          Reservoir clamped = prev;
+          clamped.num_candidates =
+              std::min(clamped.num_candidates, kReSTIRMaxHistory * reservoir.num_candidates);
+          temporal.Merge(clamped, ReservoirTarget(scene, vertex.rec, prev), rng.Uniform());
+          temporal.Finalize(ReservoirTarget(scene, vertex.rec, temporal));
+          reservoir = temporal;
+        }
+        reservoirs_[idx] = reservoir;
+      }
+    }
   };
+  scheduler_.Run(active_tiles_, generate);
 
-  std::for_each(std::execution::par, iter_.begin(), iter_.end(), per_pixel);
+  real radius = std::max(kSpatialRadius * static_cast<real>(std::max(dims_.x, dims_.y)),
+                         static_cast<real>(2));
+  auto reuse_and_shade = [&](uint32_t tile_idx, const Tile& tile) {
+    for (int y = tile.min.y; y < tile.max.y; y++) {
+      size_t idx = static_cast<size_t>(y) * dims_.x + tile.min.x;
+      for (int x = tile.min.x; x < tile.max.x; x++, idx++) {
+        const PrimaryVertex& vertex = primary_vertices_[idx];
+        vec3 color = vertex.path_radiance;
+        Reservoir spatial;
+        if (vertex.resample_direct) {
+          const HitRecord& rec = vertex.rec;
+          RNG rng{seed, static_cast<uint32_t>(idx), sample_counts_[idx], kSpatialReuseDimension};
+          spatial.Merge(reservoirs_[idx], ReservoirTarget(scene, rec, reservoirs_[idx]),
+                        rng.Uniform());
+          std::array<size_t, kSpatialNeighbors + 1> merged_indices{idx};
+          size_t num_merged = 1;
+          size_t kept = 0;
+          for (int i = 0; i < kSpatialNeighbors; i++) {
+            vec2 offset = sampling::SampleUniformDiskConcentric(rng.Uniform2D()) * radius;
+            int nx = std::clamp(x + static_cast<int>(offset.x), 0, dims_.x - 1);
+            int ny = std::clamp(y + static_cast<int>(offset.y), 0, dims_.y - 1);
+            size_t neighbor_idx = static_cast<size_t>(ny) * dims_.x + nx;
+            const PrimaryVertex& neighbor = primary_vertices_[neighbor_idx];
+            // only reuse from surfaces that look alike, 25 degrees and 10% depth apart at most
+            if (neighbor_idx == idx || !neighbor.resample_direct ||
+                glm::dot(neighbor.rec.normal, rec.normal) < 0.906 ||
+                std::abs(neighbor.rec.t - rec.t) > 0.1f * rec.t) {
+              continue;
+            }
+            if (spatial.Merge(reservoirs_[neighbor_idx],
+                              ReservoirTarget(scene, rec, reservoirs_[neighbor_idx]),
+                              rng.Uniform())) {
+              kept = num_merged;
+            }
+            merged_indices[num_merged++] = neighbor_idx;
+          }
+          // Weight the pick by the balance heuristic over the pixels it could have come from,
+          // so lights facing away from a neighbor don't darken this pixel. Stored as the
+          // candidate count that makes Finalize apply it.
+          real target_sum = 0, kept_target = 0;
+          for (size_t i = 0; i < num_merged; i++) {
+            real target = ReservoirTarget(scene, primary_vertices_[merged_indices[i]].rec, spatial);
+            target_sum += target * reservoirs_[merged_indices[i]].num_candidates;
+            if (i == kept) kept_target = target;
+          }
+          spatial.num_candidates = kept_target > 0 ? target_sum / kept_target : 0;
+          spatial.Finalize(ReservoirTarget(scene, rec, spatial));
+          if (spatial.weight > 0 && Visible(scene, rec, spatial.light_point, vertex.time, rng)) {
+            color += UnshadowedContribution(scene, rec, spatial.light_point,
+                                            spatial.light_normal, spatial.emission) *
+                     spatial.weight;
+          } else {
+            // a neighbor's light this pixel can't see, the next frame continues from the
+            // pixel's own reservoir instead
+            spatial = reservoirs_[idx];
+          }
+        }
+        spatial_reservoirs_[idx] = spatial;
+        AddSample(idx, color);
+      }
+    }
+    CheckConvergence(tile_idx, tile);
+  };
+  scheduler_.Run(active_tiles_, reuse_and_shade);
 }
 
 bool RayTracer::OnEvent(const SDL_Event& event) {
@@ -82,6 +450,8 @@ void RayTracer::OnImGui() {
   if (ImGui::Button("Reset")) {
     Reset();
   }
+  ImGui::Text("Mean spp %.1f, active tiles %zu/%zu", MeanSamplesPerPixel(), active_tiles_.size(),
+              tiles_.size());
   ImGui::End();
 }
 void RayTracer::OnResize(glm::ivec2 dims) {
@@ -91,23 +461,22 @@ void RayTracer::OnResize(glm::ivec2 dims) {
 
   size_t new_size = static_cast<size_t>(dims.x) * dims.y;
   pixels_.resize(new_size);
-  iter_.resize(new_size);
   accumulation_data_.resize(new_size);
-
-  int i = 0;
-  for (int y = 0; y < dims.y; y++) {
-    for (int x = 0; x < dims.x; x++, i++) {
-      iter_[i] = {x, y, i};
-    }
-  }
+  tiles_ = MakeTiles(dims, tile_size);
   Reset();
 }
 std::vector<vec3> RayTracer::NonConvertedPixels() const {
   std::vector<vec3> ret(accumulation_data_.size());
   for (size_t i = 0; i < ret.size(); i++) {
-    ret[i] = vec3{accumulation_data_[i].x / frame_idx_, accumulation_data_[i].y / frame_idx_,
-                  accumulation_data_[i].z / frame_idx_};
+    ret[i] = accumulation_data_[i] / static_cast<real>(std::max(sample_counts_[i], 1u));
   }
   return ret;
 }
+
+real RayTracer::MeanSamplesPerPixel() const {
+  if (sample_counts_.empty()) return 0;
+  uint64_t total = 0;
+  for (uint32_t n : sample_counts_) total += n;
+  return static_cast<real>(total) / static_cast<real>(sample_counts_.size());
+}
 }  // namespace raytrace2::cpu
@@ -5,6 +5,8 @@
 #include "BVH.hpp"
 #include "Sphere.hpp"
 #include "cpu_raytrace/Camera.hpp"
+#include "cpu_raytrace/HitRecord.hpp"
+#include "cpu_raytrace/TileScheduler.hpp"
 #include "gl/Texture.hpp"
 
 namespace raytrace2::cpu {
@@ -12,6 +14,51 @@ namespace raytrace2::cpu {
 struct Scene;
 class Camera;
 
+enum class LightSampling {
+  // emitters only contribute when a scattered ray happens to hit them
+  kBSDF,
+  // next event estimation, a shadow ray to a sampled light from every diffuse vertex
+  kNEE,
+  // light samples and BSDF sampled emitter hits both count, weighted by the power heuristic
+  kMIS,
+  // direct light at the first vertex from per pixel reservoirs resampled across neighboring
+  // pixels and previous frames (ReSTIR DI), next event estimation further along the path
+  kReSTIR,
+};
+
+// Weighted reservoir holding one light sample picked from a stream of candidates. weight is the
+// unbiased contribution weight of the sample, the reciprocal of its effective pdf.
+struct Reservoir {
+  vec3 light_point;
+  vec3 light_normal;
+  vec3 emission;
+  real weight_sum{0};
+  real num_candidates{0};
+  real weight{0};
+
+  // keeps the candidate with probability proportional to w given the uniform sample u, true if
+  // it was kept
+  bool Update(const vec3& point, const vec3& normal, const vec3& le, real w, real u) {
+    weight_sum += w;
+    num_candidates += 1;
+    if (u * weight_sum >= w) return false;
+    light_point = point;
+    light_normal = normal;
+    emission = le;
+    return true;
+  }
+  // streams in another reservoir whose sample has target at this reservoir's shading point
+  bool Merge(const Reservoir& other, real target, real u) {
+    bool kept = Update(other.light_point, other.light_normal, other.emission,
+                       target * other.weight * other.num_candidates, u);
+    num_candidates += other.num_candidates - 1;
+    return kept;
+  }
+  void Finalize(real target) {
+    weight = target > 0 ? weight_sum / (num_candidates * target) : 0;
+  }
+};
+
 struct RayTracer {
   void Update(const Scene& scene);
   void OnResize(glm::ivec2 dims);
@@ -21,6 +68,10 @@ struct RayTracer {
   [[nodiscard]] std::vector<vec3> NonConvertedPixels() const;
   [[nodiscard]] inline const PixelArray& Pixels() const { return pixels_; }
   [[nodiscard]] inline size_t FrameIdx() const { return frame_idx_; }
+  // true once adaptive sampling has retired every tile, further updates render nothing
+  [[nodiscard]] inline bool Converged() const { return active_tiles_.empty(); }
+  [[nodiscard]] inline size_t NumActiveTiles() const { return active_tiles_.size(); }
+  [[nodiscard]] real MeanSamplesPerPixel() const;
 
   bool OnEvent(const SDL_Event& event);
   void OnImGui();
@@ -30,15 +81,56 @@ struct RayTracer {
 
   Camera* camera{nullptr};
   size_t max_depth{50};
+  // bounces before paths become subject to russian roulette
+  size_t russian_roulette_min_depth{3};
+  LightSampling light_sampling{LightSampling::kMIS};
+  // side length in pixels of the square tiles handed out to workers, applied on resize
+  int tile_size{16};
+  // random numbers are a function of this, the pixel and the sample index only, so a seed
+  // renders the same image whatever the thread count
+  uint32_t seed{0};
+  SamplerType sampler_type{SamplerType::kSobol};
+  // Adaptive sampling. A tile stops being rendered once every pixel in it has at least
+  // adaptive_min_samples and a relative standard error of its luminance below
+  // adaptive_threshold. 0 renders every pixel on every update.
+  real adaptive_threshold{0};
+  uint32_t adaptive_min_samples{64};
 
  private:
   gl::Texture output_tex_;
   PixelArray pixels_;
   size_t frame_idx_{0};
   std::vector<vec3> accumulation_data_;
+  // per pixel sample counts and sums of squared luminance, which give the variance of the mean
+  std::vector<uint32_t> sample_counts_;
+  std::vector<real> luminance_sq_sums_;
+
+  // first vertex of each pixel's path and the light gathered past it, for kReSTIR
+  struct PrimaryVertex {
+    HitRecord rec;
+    real time;
+    vec3 path_radiance;
+    bool resample_direct;
+  };
+  std::vector<PrimaryVertex> primary_vertices_;
+  // reservoirs after candidate generation and temporal reuse, then after spatial reuse, which
+  // the next frame reuses temporally
+  std::vector<Reservoir> reservoirs_;
+  std::vector<Reservoir> spatial_reservoirs_;
 
-  std::vector<glm::ivec3> iter_;
+  TileScheduler scheduler_;
+  std::vector<Tile> tiles_;
+  // tiles not yet converged, and which of them converged during the current update
+  std::vector<Tile> active_tiles_;
+  std::vector<uint8_t> converged_this_update_;
   glm::ivec2 dims_;
+
+  void UpdateReSTIR(const Scene& scene, const Sampler& frame_sampler);
+  void AddSample(size_t idx, const vec3& color);
+  // called by the worker that rendered the tile once it is done with it, tile_idx indexes
+  // active_tiles_
+  void CheckConvergence(uint32_t tile_idx, const Tile& tile);
+  void RetireConvergedTiles();
 };
 
 }  // namespace raytrace2::cpu
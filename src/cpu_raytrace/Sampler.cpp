@@ -0,0 +1,238 @@
+#include "Sampler.hpp"
+
+namespace raytrace2::cpu {
+
+namespace {
+
+uint32_t ReverseBits(uint32_t x) {
+  x = (x << 16) | (x >> 16);
+  x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+  x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+  x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+  x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+  return x;
+}
+
+// Sobol generator matrix columns of the second dimension, the first is the identity reversed
+constexpr std::array<uint32_t, 32> kSobolDim1 = [] {
+  std::array<uint32_t, 32> columns{};
+  columns[0] = 1u << 31;
+  for (size_t i = 1; i < columns.size(); i++) {
+    columns[i] = columns[i - 1] ^ (columns[i - 1] >> 1);
+  }
+  return columns;
+}();
+
+// first two dimensions of the Sobol sequence, which form a (0, 2)-sequence
+uint32_t SobolSample(uint32_t index, int dimension) {
+  if (dimension == 0) return ReverseBits(index);
+  uint32_t bits = 0;
+  for (int i = 0; index; index >>= 1, i++) {
+    if (index & 1) bits ^= kSobolDim1[i];
+  }
+  return bits;
+}
+
+// Owen scrambling from a hash, randomly flipping every bit depending on the bits above it
+// (Burley 2020, with the Laine and Karras permutation)
+uint32_t NestedUniformScramble(uint32_t x, uint32_t seed) {
+  x = ReverseBits(x);
+  x += seed;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+  return ReverseBits(x);
+}
+
+// element i of a random permutation of [0, n) picked by p (Kensler 2013)
+uint32_t PermutationElement(uint32_t i, uint32_t n, uint32_t p) {
+  uint32_t w = n - 1;
+  w |= w >> 1;
+  w |= w >> 2;
+  w |= w >> 4;
+  w |= w >> 8;
+  w |= w >> 16;
+  do {
+    i ^= p;
+    i *= 0xe170893du;
+    i ^= p >> 16;
+    i ^= (i & w) >> 4;
+    i ^= p >> 8;
+    i *= 0x0929eb3fu;
+    i ^= p >> 23;
+    i ^= (i & w) >> 1;
+    i *= 1 | p >> 27;
+    i *= 0x6935fa69u;
+    i ^= (i & w) >> 11;
+    i *= 0x74dcb303u;
+    i ^= (i & w) >> 2;
+    i *= 0x9e501cc3u;
+    i ^= (i & w) >> 2;
+    i *= 0xc860a3dfu;
+    i &= w;
+    i ^= i >> 5;
+  } while (i >= n);
+  return (i + p) % n;
+}
+
+// spreads the low 32 bits of x out to the even bits
+uint64_t SpreadBits(uint64_t x) {
+  x &= 0xffffffffu;
+  x = (x ^ (x << 16)) & 0x0000ffff0000ffffull;
+  x = (x ^ (x << 8)) & 0x00ff00ff00ff00ffull;
+  x = (x ^ (x << 4)) & 0x0f0f0f0f0f0f0f0full;
+  x = (x ^ (x << 2)) & 0x3333333333333333ull;
+  x = (x ^ (x << 1)) & 0x5555555555555555ull;
+  return x;
+}
+
+uint32_t Log2Ceil(uint32_t x) { return x <= 1 ? 0 : 32 - std::countl_zero(x - 1); }
+
+// jittered position within stratum of n equal strata of [0, 1)
+real StratumSample(uint32_t stratum, real jitter, uint32_t n) {
+  return std::min((static_cast<real>(stratum) + jitter) / static_cast<real>(n),
+                  static_cast<real>(0x1.fffffep-1));
+}
+
+}  // namespace
+
+Sampler::Sampler(SamplerType type, uint32_t seed, uint32_t samples_per_pixel, glm::ivec2 dims)
+    : type_(type),
+      seed_(seed),
+      samples_per_pixel_(std::max(samples_per_pixel, 1u)),
+      log2_samples_per_pixel_(Log2Ceil(samples_per_pixel_)),
+      width_(static_cast<uint32_t>(dims.x)) {
+  uint32_t log2_resolution = Log2Ceil(static_cast<uint32_t>(std::max({dims.x, dims.y, 1})));
+  // The index along the curve has to fit the 32 bits of SobolSample, or pixels lose the digits
+  // that tell them apart and repeat each other's points. Past that, samples are dealt out in
+  // rounds of the most that fit, each with its own digit permutations.
+  uint32_t max_log2_samples = 2 * log2_resolution < 32 ? 32 - 2 * log2_resolution : 0;
+  if (type_ == SamplerType::kZSobol && log2_samples_per_pixel_ > max_log2_samples) {
+    // the sampler is made again every frame
+    static bool warned = false;
+    if (!warned) {
+      std::cerr << "ZSobol sample index limited to 32 bits, using rounds of "
+                << (1u << max_log2_samples) << " samples per pixel\n";
+      warned = true;
+    }
+    log2_samples_per_pixel_ = max_log2_samples;
+  }
+  num_base4_digits_ = log2_resolution + (log2_samples_per_pixel_ + 1) / 2;
+}
+
+void Sampler::StartPixelSample(glm::ivec2 pixel, uint32_t sample_idx) {
+  pixel_ = pixel;
+  pixel_idx_ = static_cast<uint32_t>(pixel.y) * width_ + static_cast<uint32_t>(pixel.x);
+  sample_idx_ = sample_idx;
+  dimension_ = 0;
+  rng_ = RNG{seed_, pixel_idx_, sample_idx_};
+}
+
+uint64_t Sampler::DimensionHash(uint32_t round) const {
+  uint64_t key = MixBits((static_cast<uint64_t>(pixel_idx_) << 32) | dimension_);
+  return MixBits(key ^ ((static_cast<uint64_t>(round) << 32) | seed_));
+}
+
+uint32_t Sampler::ZSobolIndex(uint32_t dimension) const {
+  // every ordering of a base 4 digit
+  static constexpr uint8_t kPermutations[24][4] = {
+      {0, 1, 2, 3}, {0, 1, 3, 2}, {0, 2, 1, 3}, {0, 2, 3, 1}, {0, 3, 2, 1}, {0, 3, 1, 2},
+      {1, 0, 2, 3}, {1, 0, 3, 2}, {1, 2, 0, 3}, {1, 2, 3, 0}, {1, 3, 2, 0}, {1, 3, 0, 2},
+      {2, 1, 0, 3}, {2, 1, 3, 0}, {2, 0, 1, 3}, {2, 0, 3, 1}, {2, 3, 0, 1}, {2, 3, 1, 0},
+      {3, 1, 2, 0}, {3, 1, 0, 2}, {3, 2, 1, 0}, {3, 2, 0, 1}, {3, 0, 2, 1}, {3, 0, 1, 2}};
+  // the pixel's place on the Morton curve followed by the sample within the pixel, so each
+  // block of 4^k pixels shares the same well distributed run of points
+  uint32_t spp_mask = (1u << log2_samples_per_pixel_) - 1;
+  uint64_t morton = (SpreadBits(pixel_.x) | (SpreadBits(pixel_.y) << 1));
+  morton = (morton << log2_samples_per_pixel_) | (sample_idx_ & spp_mask);
+  uint64_t key = 0x5555555555555555ull *
+                 (dimension | static_cast<uint64_t>(sample_idx_ >> log2_samples_per_pixel_)
+                                  << 32);
+
+  // shuffle each base 4 digit by its higher digits, which keeps blocks of the curve together
+  // while decorrelating the dimensions
+  uint64_t index = 0;
+  bool odd = log2_samples_per_pixel_ & 1;
+  for (int i = static_cast<int>(num_base4_digits_) - 1; i >= (odd ? 1 : 0); i--) {
+    int shift = 2 * i - (odd ? 1 : 0);
+    uint32_t digit = (morton >> shift) & 3;
+    uint64_t higher_digits = morton >> (shift + 2);
+    uint32_t p = (MixBits(higher_digits ^ key) >> 24) % 24;
+    index |= static_cast<uint64_t>(kPermutations[p][digit]) << shift;
+  }
+  if (odd) index |= (morton & 1) ^ (MixBits((morton >> 1) ^ key) & 1);
+  return static_cast<uint32_t>(index);
+}
+
+real Sampler::Get1D() {
+  real u{0};
+  switch (type_) {
+    case SamplerType::kIndependent:
+      u = BitsToUniform(static_cast<uint32_t>(DimensionHash(sample_idx_)));
+      break;
+    case SamplerType::kStratified: {
+      uint64_t hash = DimensionHash(sample_idx_ / samples_per_pixel_);
+      uint32_t idx = sample_idx_ % samples_per_pixel_;
+      uint32_t stratum = PermutationElement(idx, samples_per_pixel_, static_cast<uint32_t>(hash));
+      u = StratumSample(stratum, BitsToUniform(static_cast<uint32_t>(hash >> 32) ^ idx),
+                        samples_per_pixel_);
+      break;
+    }
+    case SamplerType::kSobol: {
+      uint64_t hash = DimensionHash(0);
+      uint32_t index = NestedUniformScramble(sample_idx_, static_cast<uint32_t>(hash));
+      u = BitsToUniform(NestedUniformScramble(SobolSample(index, 0), hash >> 32));
+      break;
+    }
+    case SamplerType::kZSobol: {
+      uint64_t hash = MixBits((static_cast<uint64_t>(dimension_) << 32) | seed_);
+      uint32_t index = ZSobolIndex(dimension_);
+      u = BitsToUniform(NestedUniformScramble(SobolSample(index, 0), hash));
+      break;
+    }
+  }
+  dimension_++;
+  return u;
+}
+
+vec2 Sampler::Get2D() {
+  vec2 u{0};
+  switch (type_) {
+    case SamplerType::kIndependent: {
+      uint64_t hash = DimensionHash(sample_idx_);
+      u = {BitsToUniform(static_cast<uint32_t>(hash)), BitsToUniform(hash >> 32)};
+      break;
+    }
+    case SamplerType::kStratified: {
+      // a square grid with at least one stratum per sample, each sample in its own stratum
+      auto side = static_cast<uint32_t>(std::ceil(std::sqrt(samples_per_pixel_)));
+      uint64_t hash = DimensionHash(sample_idx_ / samples_per_pixel_);
+      uint32_t idx = sample_idx_ % samples_per_pixel_;
+      uint32_t stratum = PermutationElement(idx, side * side, static_cast<uint32_t>(hash));
+      uint64_t jitter = MixBits(hash ^ idx);
+      u = {StratumSample(stratum % side, BitsToUniform(static_cast<uint32_t>(jitter)), side),
+           StratumSample(stratum / side, BitsToUniform(jitter >> 32), side)};
+      break;
+    }
+    case SamplerType::kSobol: {
+      uint64_t hash = DimensionHash(0);
+      uint32_t index = NestedUniformScramble(sample_idx_, static_cast<uint32_t>(hash));
+      uint64_t scramble = MixBits(hash);
+      u = {BitsToUniform(NestedUniformScramble(SobolSample(index, 0), scramble)),
+           BitsToUniform(NestedUniformScramble(SobolSample(index, 1), scramble >> 32))};
+      break;
+    }
+    case SamplerType::kZSobol: {
+      uint64_t hash = MixBits((static_cast<uint64_t>(dimension_) << 32) | seed_);
+      uint32_t index = ZSobolIndex(dimension_);
+      u = {BitsToUniform(NestedUniformScramble(SobolSample(index, 0), hash)),
+           BitsToUniform(NestedUniformScramble(SobolSample(index, 1), hash >> 32))};
+      break;
+    }
+  }
+  dimension_ += 2;
+  return u;
+}
+
+}  // namespace raytrace2::cpu
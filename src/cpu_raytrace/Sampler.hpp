@@ -0,0 +1,63 @@
+#pragma once
+
+#include "Defs.hpp"
+#include "cpu_raytrace/RNG.hpp"
+
+namespace raytrace2::cpu {
+
+enum class SamplerType {
+  // a fresh random number for every dimension
+  kIndependent,
+  // jittered strata of each dimension, visited in a shuffled order per pixel and dimension
+  kStratified,
+  // Owen scrambled Sobol points, with the point order shuffled per pixel and dimension so the
+  // dimensions don't correlate (padding)
+  kSobol,
+  // Owen scrambled Sobol points dealt out to pixels along a Morton curve, so neighboring pixels
+  // get complementary points and the error is blue noise (Ahmed and Wonka 2020)
+  kZSobol,
+};
+
+// Values of the sample dimensions of one pixel sample. Users read the dimensions in a fixed
+// layout, setting the dimension before each group of reads, so the same dimension serves the
+// same purpose in every sample of a pixel and stratifies it. Samples past samples_per_pixel
+// start over with new strata and scrambles, so rendering can go on progressively.
+class Sampler {
+ public:
+  Sampler() = default;
+  // samples_per_pixel and dims size the strata of kStratified and the curve of kZSobol
+  Sampler(SamplerType type, uint32_t seed, uint32_t samples_per_pixel, glm::ivec2 dims);
+
+  void StartPixelSample(glm::ivec2 pixel, uint32_t sample_idx);
+  void SetDimension(uint32_t dimension) { dimension_ = dimension; }
+
+  // uniform in [0, 1), each moves on by as many dimensions as it returns
+  real Get1D();
+  vec2 Get2D();
+
+  // random numbers for uses that draw an unknown amount of them, such as media along a ray,
+  // independent of the sample dimensions
+  RNG& Rng() { return rng_; }
+
+ private:
+  SamplerType type_{SamplerType::kSobol};
+  uint32_t seed_{0};
+  uint32_t samples_per_pixel_{1};
+  // kZSobol rounds samples per pixel and resolution up to powers of two, capping samples per
+  // pixel so the index along its curve fits in 32 bits
+  uint32_t log2_samples_per_pixel_{0};
+  uint32_t num_base4_digits_{0};
+  uint32_t width_{0};
+
+  glm::ivec2 pixel_{0};
+  uint32_t pixel_idx_{0};
+  uint32_t sample_idx_{0};
+  uint32_t dimension_{0};
+  RNG rng_;
+
+  // hash of the pixel, dimension and seed, and of which pass over the strata sample_idx_ is in
+  [[nodiscard]] uint64_t DimensionHash(uint32_t round) const;
+  [[nodiscard]] uint32_t ZSobolIndex(uint32_t dimension) const;
+};
+
+}  // namespace raytrace2::cpu
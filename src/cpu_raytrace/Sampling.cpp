@@ -0,0 +1,153 @@
+#include "Sampling.hpp"
+
+namespace raytrace2::cpu::sampling {
+
+namespace {
+
+constexpr real kPi = std::numbers::pi_v<real>;
+
+real SafeSqrt(real x) { return std::sqrt(std::max(static_cast<real>(0), x)); }
+
+// angle between unit vectors, accurate when they are nearly parallel or opposite
+real AngleBetween(const vec3& a, const vec3& b) {
+  if (glm::dot(a, b) < 0) {
+    return kPi - 2 * std::asin(std::min(glm::length(a + b) / 2, static_cast<real>(1)));
+  }
+  return 2 * std::asin(std::min(glm::length(b - a) / 2, static_cast<real>(1)));
+}
+
+// component of v orthogonal to unit vector w
+vec3 GramSchmidt(const vec3& v, const vec3& w) { return v - glm::dot(v, w) * w; }
+
+// solid angle of the triangle with unit vertex directions a, b and c (Van Oosterom and
+// Strackee 1983)
+real TriangleSolidAngle(const vec3& a, const vec3& b, const vec3& c) {
+  real numerator = std::abs(glm::dot(a, glm::cross(b, c)));
+  real denominator = 1 + glm::dot(a, b) + glm::dot(a, c) + glm::dot(b, c);
+  return 2 * std::atan2(numerator, denominator);
+}
+
+// direction from ref uniform over the solid angle of the triangle with unit vertex directions
+// a, b and c, false if the triangle is degenerate as seen from ref
+bool SampleSphericalTriangle(const vec3& a, const vec3& b, const vec3& c, vec2 u, vec3& w) {
+  vec3 n_ab = glm::cross(a, b), n_bc = glm::cross(b, c), n_ca = glm::cross(c, a);
+  if (glm::dot(n_ab, n_ab) == 0 || glm::dot(n_bc, n_bc) == 0 || glm::dot(n_ca, n_ca) == 0) {
+    return false;
+  }
+  n_ab = glm::normalize(n_ab);
+  n_bc = glm::normalize(n_bc);
+  n_ca = glm::normalize(n_ca);
+
+  // angles at the vertices, whose excess over pi is the area
+  real alpha = AngleBetween(n_ab, -n_ca);
+  real beta = AngleBetween(n_bc, -n_ab);
+  real gamma = AngleBetween(n_ca, -n_bc);
+
+  // pick the sub-triangle a, b, c' with area u.x times the full area
+  real area_pi = alpha + beta + gamma;
+  real sub_area_pi = kPi + u.x * (area_pi - kPi);
+  real cos_alpha = std::cos(alpha), sin_alpha = std::sin(alpha);
+  real sin_phi = std::sin(sub_area_pi) * cos_alpha - std::cos(sub_area_pi) * sin_alpha;
+  real cos_phi = std::cos(sub_area_pi) * cos_alpha + std::sin(sub_area_pi) * sin_alpha;
+  real k1 = cos_phi + cos_alpha;
+  real k2 = sin_phi - sin_alpha * glm::dot(a, b);
+  real cos_bp = (k2 + (k2 * cos_phi - k1 * sin_phi) * cos_alpha) /
+                ((k2 * sin_phi + k1 * cos_phi) * sin_alpha);
+  // the triangle covers almost the whole hemisphere
+  cos_bp = std::clamp(cos_bp, static_cast<real>(-1), static_cast<real>(1));
+
+  // c' on the arc from a to c, then the direction along the arc from b to c'
+  real sin_bp = SafeSqrt(1 - cos_bp * cos_bp);
+  vec3 cp = cos_bp * a + sin_bp * glm::normalize(GramSchmidt(c, a));
+  real cos_theta = 1 - u.y * (1 - glm::dot(cp, b));
+  real sin_theta = SafeSqrt(1 - cos_theta * cos_theta);
+  w = cos_theta * b + sin_theta * glm::normalize(GramSchmidt(cp, b));
+  return true;
+}
+
+// point where the ray from ref along w meets the plane of the triangle, clamped into it
+vec3 TrianglePoint(const vec3& v0, const vec3& v1, const vec3& v2, const vec3& ref,
+                   const vec3& w) {
+  vec3 e1 = v1 - v0, e2 = v2 - v0;
+  vec3 s1 = glm::cross(w, e2);
+  real divisor = glm::dot(s1, e1);
+  if (divisor == 0) return (v0 + v1 + v2) / static_cast<real>(3);
+  vec3 s = ref - v0;
+  real b1 = std::clamp(glm::dot(s, s1) / divisor, static_cast<real>(0), static_cast<real>(1));
+  real b2 = std::clamp(glm::dot(w, glm::cross(s, e1)) / divisor, static_cast<real>(0),
+                       static_cast<real>(1));
+  if (b1 + b2 > 1) {
+    real sum = b1 + b2;
+    b1 /= sum;
+    b2 /= sum;
+  }
+  return v0 + b1 * e1 + b2 * e2;
+}
+
+}  // namespace
+
+vec3 SampleSphereSolidAngle(const vec3& center, real radius, const vec3& ref, vec2 u,
+                            vec3& normal) {
+  vec3 to_ref = ref - center;
+  real dist_sq = glm::dot(to_ref, to_ref);
+  real sin2_theta_max = radius * radius / dist_sq;
+  real cos_theta_max = SafeSqrt(1 - sin2_theta_max);
+  real cos_theta = (cos_theta_max - 1) * u.x + 1;
+  real sin2_theta = 1 - cos_theta * cos_theta;
+  // 1 - cos_theta_max rounds badly for small or distant spheres, use its series instead
+  if (sin2_theta_max < static_cast<real>(0.00068523)) {
+    sin2_theta = sin2_theta_max * u.x;
+    cos_theta = std::sqrt(1 - sin2_theta);
+  }
+  // angle from the center to the sampled point, seen from the sphere center
+  real cos_alpha = sin2_theta / std::sqrt(sin2_theta_max) +
+                   cos_theta * SafeSqrt(1 - sin2_theta / sin2_theta_max);
+  real sin_alpha = SafeSqrt(1 - cos_alpha * cos_alpha);
+  real phi = 2 * kPi * u.y;
+  vec3 w = to_ref / std::sqrt(dist_sq);
+  vec3 t, b;
+  math::BuildONB(w, t, b);
+  normal = sin_alpha * std::cos(phi) * t + sin_alpha * std::sin(phi) * b + cos_alpha * w;
+  return center + radius * normal;
+}
+
+real SphereSolidAnglePDF(const vec3& center, real radius, const vec3& ref) {
+  vec3 to_ref = ref - center;
+  real sin2_theta_max = radius * radius / glm::dot(to_ref, to_ref);
+  real one_minus_cos_theta_max = sin2_theta_max < static_cast<real>(0.00068523)
+                                     ? sin2_theta_max / 2
+                                     : 1 - SafeSqrt(1 - sin2_theta_max);
+  return 1 / (2 * kPi * one_minus_cos_theta_max);
+}
+
+real QuadSolidAngle(const vec3& q, const vec3& u, const vec3& v, const vec3& ref) {
+  vec3 a = glm::normalize(q - ref), b = glm::normalize(q + u - ref);
+  vec3 c = glm::normalize(q + u + v - ref), d = glm::normalize(q + v - ref);
+  return TriangleSolidAngle(a, b, c) + TriangleSolidAngle(a, c, d);
+}
+
+vec3 SampleQuadSolidAngle(const vec3& q, const vec3& u, const vec3& v, const vec3& ref,
+                          vec2 sample_u) {
+  vec3 corners[4] = {q, q + u, q + u + v, q + v};
+  vec3 dirs[4];
+  for (int i = 0; i < 4; i++) dirs[i] = glm::normalize(corners[i] - ref);
+  real solid_angle_0 = TriangleSolidAngle(dirs[0], dirs[1], dirs[2]);
+  real solid_angle_1 = TriangleSolidAngle(dirs[0], dirs[2], dirs[3]);
+  real total = solid_angle_0 + solid_angle_1;
+  // reuse u.x for the sample within the picked triangle
+  int second = sample_u.x * total >= solid_angle_0 ? 1 : 0;
+  if (second) {
+    sample_u.x = (sample_u.x * total - solid_angle_0) / solid_angle_1;
+  } else {
+    sample_u.x = sample_u.x * total / solid_angle_0;
+  }
+  sample_u.x = std::min(sample_u.x, static_cast<real>(0x1.fffffep-1));
+  int i1 = 1 + second, i2 = 2 + second;
+  vec3 w;
+  if (!SampleSphericalTriangle(dirs[0], dirs[i1], dirs[i2], sample_u, w)) {
+    return q + (u + v) * static_cast<real>(0.5);
+  }
+  return TrianglePoint(corners[0], corners[i1], corners[i2], ref, w);
+}
+
+}  // namespace raytrace2::cpu::sampling
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "Defs.hpp"
+#include "cpu_raytrace/Math.hpp"
+
+// Closed form warps from uniform samples in [0, 1)^2 to common domains, each with the density it
+// produces. They take their random numbers explicitly so stratified or low discrepancy samples
+// carry through, and run in constant time unlike rejection sampling.
+namespace raytrace2::cpu::sampling {
+
+// uniform over the unit disk, keeping strata compact (Shirley and Chiu 1997)
+inline vec2 SampleUniformDiskConcentric(vec2 u) {
+  vec2 offset = 2 * u - vec2{1};
+  if (offset.x == 0 && offset.y == 0) return vec2{0};
+  constexpr real kPiOver4 = std::numbers::pi_v<real> / 4;
+  real r, theta;
+  if (std::abs(offset.x) > std::abs(offset.y)) {
+    r = offset.x;
+    theta = kPiOver4 * (offset.y / offset.x);
+  } else {
+    r = offset.y;
+    theta = 2 * kPiOver4 - kPiOver4 * (offset.x / offset.y);
+  }
+  return r * vec2{std::cos(theta), std::sin(theta)};
+}
+
+inline vec3 SampleUniformSphere(vec2 u) {
+  real z = 1 - 2 * u.x;
+  real r = std::sqrt(std::max(static_cast<real>(0), 1 - z * z));
+  real phi = 2 * std::numbers::pi_v<real> * u.y;
+  return {r * std::cos(phi), r * std::sin(phi), z};
+}
+
+inline real UniformSpherePDF() { return static_cast<real>(0.25) * std::numbers::inv_pi_v<real>; }
+
+// cosine weighted around +z, by projecting the concentric disk up onto the hemisphere
+inline vec3 SampleCosineHemisphere(vec2 u) {
+  vec2 d = SampleUniformDiskConcentric(u);
+  real z = std::sqrt(std::max(static_cast<real>(0), 1 - d.x * d.x - d.y * d.y));
+  return {d.x, d.y, z};
+}
+
+// cosine weighted around the unit normal n
+inline vec3 SampleCosineHemisphere(const vec3& n, vec2 u) {
+  vec3 t, b;
+  math::BuildONB(n, t, b);
+  vec3 local = SampleCosineHemisphere(u);
+  return local.x * t + local.y * b + local.z * n;
+}
+
+inline real CosineHemispherePDF(real cos_theta) {
+  return std::max(cos_theta, static_cast<real>(0)) * std::numbers::inv_pi_v<real>;
+}
+
+// Point on the sphere uniform over the cone of directions it subtends from ref, which must lie
+// outside it (PBRT 4th ed. 6.2.4). normal is the outward normal at the point.
+vec3 SampleSphereSolidAngle(const vec3& center, real radius, const vec3& ref, vec2 u,
+                            vec3& normal);
+// solid angle density of SampleSphereSolidAngle, the same for every point it can return
+real SphereSolidAnglePDF(const vec3& center, real radius, const vec3& ref);
+
+// solid angle the parallelogram at q spanned by edges u and v subtends from ref
+real QuadSolidAngle(const vec3& q, const vec3& u, const vec3& v, const vec3& ref);
+// Point on the parallelogram uniform over the solid angle it subtends from ref, with density
+// 1 / QuadSolidAngle. Samples one of its two triangles by their share of the solid angle and
+// warps within it (Arvo 1995, as in PBRT 4th ed. 6.5.4). Loses precision for quads that are
+// tiny or huge as seen from ref, where callers should sample by area instead.
+vec3 SampleQuadSolidAngle(const vec3& q, const vec3& u, const vec3& v, const vec3& ref,
+                          vec2 sample_u);
+
+}  // namespace raytrace2::cpu::sampling
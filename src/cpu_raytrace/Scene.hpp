@@ -7,15 +7,20 @@
 #include "cpu_raytrace/BVH.hpp"
 #include "cpu_raytrace/Camera.hpp"
 #include "cpu_raytrace/HittableList.hpp"
+#include "cpu_raytrace/LightBVH.hpp"
 #include "cpu_raytrace/Sphere.hpp"
 #include "cpu_raytrace/Texture.hpp"
 
 namespace raytrace2::cpu {
 
-struct BVHNode;
+struct BVH;
 
 struct Scene {
   HittableList hittable_list;
+  // emissive primitives sampled for direct lighting, all of them live in hittable_list too
+  std::vector<std::shared_ptr<Hittable>> lights;
+  // picks from lights by their estimated contribution at a shading point
+  LightBVH light_bvh;
   std::vector<MaterialVariant> materials;
   texture::TexArray textures;
   Camera cam;
@@ -1,38 +1,263 @@
 #include "Sphere.hpp"
 
+#if (defined(__SSE2__) || defined(_M_X64)) && !defined(DOUBLE)
+#include <immintrin.h>
+#define RAYTRACE2_SSE
+#endif
+
+#include <bit>
+#include <limits>
+
 #include "Material.hpp"
+#include "cpu_raytrace/LightBVH.hpp"
+#include "cpu_raytrace/Math.hpp"
+#include "cpu_raytrace/Sampling.hpp"
 #include "cpu_raytrace/Scene.hpp"
 
 namespace raytrace2::cpu {
-bool Sphere::Hit(const Scene& scene, const Ray& r, Interval ray_t, HitRecord& rec) const {
-  auto curr_center = center_displacement.At(r.time);
-  vec3 oc = curr_center - r.origin;
+
+namespace {
+
+// both distances at which r crosses the sphere, nearest first
+bool Roots(const vec3& center, real radius, const Ray& r, real& near_root, real& far_root) {
+  vec3 oc = center - r.origin;
   auto a = glm::dot(r.direction, r.direction);
   auto h = glm::dot(r.direction, oc);
   auto c = glm::dot(oc, oc) - radius * radius;
-  auto discriminant = h * h - a * c;
+  // h * h - a * c cancels badly for spheres that are small relative to their distance, which
+  // baked scene graph transforms make common. Measure it from the closest point on the ray.
+  vec3 closest = oc - (h / a) * r.direction;
+  auto discriminant = a * (radius * radius - glm::dot(closest, closest));
 
   if (discriminant < 0) return false;
 
   auto sqrtd = std::sqrt(discriminant);
 
+  // roots as c / q and q / a so neither subtracts nearly equal values
+  auto q = h + std::copysign(sqrtd, h);
+  near_root = c / q;
+  far_root = q / a;
+  if (near_root > far_root) std::swap(near_root, far_root);
+  return true;
+}
+
+bool NearestRoot(const vec3& center, real radius, const Ray& r, Interval ray_t, real& root) {
+  real near_root, far_root;
+  if (!Roots(center, radius, r, near_root, far_root)) return false;
+
   // find the nearest root in range.
-  auto root = (h - sqrtd) / a;
+  root = near_root;
   if (!ray_t.Surrounds(root)) {
-    root = (h + sqrtd) / a;
+    root = far_root;
     if (!ray_t.Surrounds(root)) {
       return false;
     }
   }
+  return true;
+}
+
+}  // namespace
 
-  rec.t = root;
+bool Sphere::Hit(const Scene& scene, const Ray& r, Interval ray_t, RNG&, HitRecord& rec) const {
+  real t;
+  if (!Intersect(r, ray_t, t)) return false;
+  SetHitRecord(scene, r, t, rec);
+  return true;
+}
+
+bool Sphere::Intersect(const Ray& r, Interval ray_t, real& t) const {
+  return NearestRoot(center_displacement.At(r.time), radius, r, ray_t, t);
+}
+
+void Sphere::SetHitRecord(const Scene& scene, const Ray& r, real t, HitRecord& rec) const {
+  rec.t = t;
   rec.point = r.At(rec.t);
 
   rec.material = &scene.materials[material_handle];
-  vec3 outward_normal = (rec.point - curr_center) / radius;
+  rec.object = this;
+  vec3 outward_normal = (rec.point - center_displacement.At(r.time)) / radius;
   rec.SetFaceNormal(r, outward_normal);
-  rec.uv = GetUV(outward_normal);
+  if (SamplesTexture(*rec.material)) rec.uv = GetUV(outward_normal);
+}
+
+SphereBlock::SphereBlock() {
+  for (uint32_t i = 0; i < kWidth; i++) {
+    center_x[i] = center_y[i] = center_z[i] = std::numeric_limits<real>::quiet_NaN();
+    displacement_x[i] = displacement_y[i] = displacement_z[i] = 0;
+    radius[i] = 0;
+  }
+}
+
+void SphereBlock::Set(uint32_t lane, const Sphere& sphere) {
+  center_x[lane] = sphere.center_displacement.origin.x;
+  center_y[lane] = sphere.center_displacement.origin.y;
+  center_z[lane] = sphere.center_displacement.origin.z;
+  displacement_x[lane] = sphere.center_displacement.direction.x;
+  displacement_y[lane] = sphere.center_displacement.direction.y;
+  displacement_z[lane] = sphere.center_displacement.direction.z;
+  radius[lane] = sphere.radius;
+}
+
+// NearestRoot across the lanes
+int SphereBlock::NearestHit(const Ray& r, Interval ray_t, real& t) const {
+#ifdef RAYTRACE2_SSE
+  __m128 time = _mm_set1_ps(r.time);
+  __m128 dir_x = _mm_set1_ps(r.direction.x);
+  __m128 dir_y = _mm_set1_ps(r.direction.y);
+  __m128 dir_z = _mm_set1_ps(r.direction.z);
+  __m128 oc_x = _mm_sub_ps(_mm_add_ps(_mm_load_ps(center_x),
+                                      _mm_mul_ps(_mm_load_ps(displacement_x), time)),
+                           _mm_set1_ps(r.origin.x));
+  __m128 oc_y = _mm_sub_ps(_mm_add_ps(_mm_load_ps(center_y),
+                                      _mm_mul_ps(_mm_load_ps(displacement_y), time)),
+                           _mm_set1_ps(r.origin.y));
+  __m128 oc_z = _mm_sub_ps(_mm_add_ps(_mm_load_ps(center_z),
+                                      _mm_mul_ps(_mm_load_ps(displacement_z), time)),
+                           _mm_set1_ps(r.origin.z));
+  __m128 rad = _mm_load_ps(radius);
+  __m128 radius_sq = _mm_mul_ps(rad, rad);
+  __m128 a = _mm_set1_ps(glm::dot(r.direction, r.direction));
+  __m128 h = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dir_x, oc_x), _mm_mul_ps(dir_y, oc_y)),
+                        _mm_mul_ps(dir_z, oc_z));
+  __m128 c = _mm_sub_ps(
+      _mm_add_ps(_mm_add_ps(_mm_mul_ps(oc_x, oc_x), _mm_mul_ps(oc_y, oc_y)),
+                 _mm_mul_ps(oc_z, oc_z)),
+      radius_sq);
+  __m128 h_over_a = _mm_div_ps(h, a);
+  __m128 closest_x = _mm_sub_ps(oc_x, _mm_mul_ps(h_over_a, dir_x));
+  __m128 closest_y = _mm_sub_ps(oc_y, _mm_mul_ps(h_over_a, dir_y));
+  __m128 closest_z = _mm_sub_ps(oc_z, _mm_mul_ps(h_over_a, dir_z));
+  __m128 closest_sq = _mm_add_ps(
+      _mm_add_ps(_mm_mul_ps(closest_x, closest_x), _mm_mul_ps(closest_y, closest_y)),
+      _mm_mul_ps(closest_z, closest_z));
+  __m128 discriminant = _mm_mul_ps(a, _mm_sub_ps(radius_sq, closest_sq));
+  // false for the NaN of empty lanes
+  __m128 hit = _mm_cmpge_ps(discriminant, _mm_setzero_ps());
+  if (_mm_movemask_ps(hit) == 0) return -1;
+
+  __m128 sqrtd = _mm_sqrt_ps(_mm_max_ps(discriminant, _mm_setzero_ps()));
+  __m128 sign_mask = _mm_set1_ps(-0.f);
+  __m128 q = _mm_add_ps(h, _mm_or_ps(_mm_and_ps(h, sign_mask), sqrtd));
+  __m128 root_0 = _mm_div_ps(c, q);
+  __m128 root_1 = _mm_div_ps(q, a);
+  __m128 near_root = _mm_min_ps(root_0, root_1);
+  __m128 far_root = _mm_max_ps(root_0, root_1);
+  __m128 t_min = _mm_set1_ps(ray_t.min);
+  __m128 t_max = _mm_set1_ps(ray_t.max);
+  __m128 near_in = _mm_and_ps(_mm_cmpgt_ps(near_root, t_min), _mm_cmplt_ps(near_root, t_max));
+  __m128 far_in = _mm_and_ps(_mm_cmpgt_ps(far_root, t_min), _mm_cmplt_ps(far_root, t_max));
+  hit = _mm_and_ps(hit, _mm_or_ps(near_in, far_in));
+  int hit_mask = _mm_movemask_ps(hit);
+  if (hit_mask == 0) return -1;
+
+  __m128 root = _mm_or_ps(_mm_and_ps(near_in, near_root), _mm_andnot_ps(near_in, far_root));
+  root = _mm_or_ps(_mm_and_ps(hit, root), _mm_andnot_ps(hit, _mm_set1_ps(kInfinity)));
+  // smallest root in every lane, then the first lane holding it
+  __m128 nearest = _mm_min_ps(root, _mm_shuffle_ps(root, root, _MM_SHUFFLE(2, 3, 0, 1)));
+  nearest = _mm_min_ps(nearest, _mm_shuffle_ps(nearest, nearest, _MM_SHUFFLE(1, 0, 3, 2)));
+  t = _mm_cvtss_f32(nearest);
+  return std::countr_zero(
+      static_cast<unsigned>(_mm_movemask_ps(_mm_cmpeq_ps(root, nearest)) & hit_mask));
+#else
+  int nearest = -1;
+  for (uint32_t i = 0; i < kWidth; i++) {
+    vec3 center{center_x[i] + displacement_x[i] * r.time, center_y[i] + displacement_y[i] * r.time,
+                center_z[i] + displacement_z[i] * r.time};
+    real root;
+    // NaN centers give a NaN root, which is never in range
+    if (NearestRoot(center, radius[i], r, ray_t, root)) {
+      nearest = static_cast<int>(i);
+      t = root;
+      ray_t.max = root;
+    }
+  }
+  return nearest;
+#endif
+}
+
+bool Sphere::Occluded(const Scene&, const Ray& r, Interval ray_t, RNG&) const {
+  real t;
+  return Intersect(r, ray_t, t);
+}
+
+bool Sphere::Span(const Ray& r, real& t_enter, real& t_exit) const {
+  return Roots(center_displacement.At(r.time), radius, r, t_enter, t_exit);
+}
+
+AABB Sphere::GetTransformedAABB(const mat4& transform) const {
+  // the sphere maps to an ellipsoid whose extent along each axis is the radius times the length
+  // of that row of the linear part
+  mat3 linear{transform};
+  vec3 extent = radius * vec3{glm::length(vec3{linear[0][0], linear[1][0], linear[2][0]}),
+                              glm::length(vec3{linear[0][1], linear[1][1], linear[2][1]}),
+                              glm::length(vec3{linear[0][2], linear[1][2], linear[2][2]})};
+  vec3 start = vec3(transform * vec4(center_displacement.At(0), 1));
+  vec3 end = vec3(transform * vec4(center_displacement.At(1), 1));
+  return AABB{AABB{start - extent, start + extent}, AABB{end - extent, end + extent}};
+}
+
+std::shared_ptr<Hittable> Sphere::BakeTransform(const mat4& transform) const {
+  mat3 linear{transform};
+  real scale = glm::length(linear[0]);
+  constexpr real kEpsilon = 1e-4;
+  for (int i = 0; i < 3; i++) {
+    if (std::abs(glm::length(linear[i]) - scale) > kEpsilon * scale) return nullptr;
+    if (std::abs(glm::dot(linear[i], linear[(i + 1) % 3])) > kEpsilon * scale * scale) {
+      return nullptr;
+    }
+  }
+  return std::make_shared<Sphere>(vec3(transform * vec4(center_displacement.origin, 1)),
+                                  linear * center_displacement.direction, radius * scale,
+                                  material_handle);
+}
+
+bool Sphere::SampleLight(const vec3& ref, vec2 u, real time, LightSample& sample) const {
+  vec3 center = center_displacement.At(time);
+  vec3 to_ref = ref - center;
+  if (glm::dot(to_ref, to_ref) <= radius * radius) {
+    // inside, sample the area uniformly and convert to solid angle
+    sample.normal = sampling::SampleUniformSphere(u);
+    sample.point = center + radius * sample.normal;
+    sample.pdf = LightPDF(ref, sample.point, time);
+    if (sample.pdf == 0) return false;
+    sample.uv = GetUV(sample.normal);
+    // the inside emits towards ref
+    sample.normal = -sample.normal;
+  } else {
+    sample.point = sampling::SampleSphereSolidAngle(center, radius, ref, u, sample.normal);
+    sample.pdf = sampling::SphereSolidAnglePDF(center, radius, ref);
+    sample.uv = GetUV(sample.normal);
+  }
+  sample.material_handle = material_handle;
+  return true;
+}
+
+real Sphere::LightPDF(const vec3& ref, const vec3& point, real time) const {
+  vec3 center = center_displacement.At(time);
+  vec3 to_ref = ref - center;
+  real radius_sq = radius * radius;
+  if (glm::dot(to_ref, to_ref) > radius_sq) {
+    return sampling::SphereSolidAnglePDF(center, radius, ref);
+  }
+  vec3 to_light = point - ref;
+  real light_dist_sq = glm::dot(to_light, to_light);
+  real cos_light =
+      std::abs(glm::dot(point - center, to_light)) / (radius * std::sqrt(light_dist_sq));
+  if (cos_light < 1e-6) return 0;
+  return light_dist_sq * sampling::UniformSpherePDF() / (cos_light * radius_sq);
+}
 
+bool Sphere::GetLightBounds(const Scene& scene, LightBounds& light_bounds) const {
+  constexpr real kPi = std::numbers::pi_v<real>;
+  vec3 center = center_displacement.At(0);
+  light_bounds.phi = 4 * kPi * kPi * radius * radius *
+                     EmittedRadiance(scene, material_handle, vec2{0.5}, center);
+  // normals point every way, the bounds cover the motion over the shutter
+  light_bounds.bounds = aabb;
+  light_bounds.w = vec3{0, 0, 1};
+  light_bounds.cos_theta_o = -1;
+  light_bounds.cos_theta_e = 0;
+  light_bounds.two_sided = false;
   return true;
 }
 
@@ -11,7 +11,7 @@
 namespace raytrace2::cpu {
 struct Scene;
 
-struct Sphere : public Hittable {
+struct Sphere final : public Hittable {
   Sphere(const vec3& static_center, real radius, uint32_t material_handle)
       : center_displacement(static_center, {0, 0, 0}),
         aabb(static_center - vec3(radius), static_center + vec3(radius)),
@@ -32,11 +32,43 @@ struct Sphere : public Hittable {
   AABB aabb;
   real radius;
   uint32_t material_handle;
-  bool Hit(const Scene& scene, const Ray& r, Interval ray_t, HitRecord& rec) const override;
+  uint32_t light_idx{kNotALight};
+  bool Hit(const Scene& scene, const Ray& r, Interval ray_t, RNG& rng,
+           HitRecord& rec) const override;
+  bool Occluded(const Scene& scene, const Ray& r, Interval ray_t, RNG& rng) const override;
   [[nodiscard]] AABB GetAABB() const override { return aabb; }
+  [[nodiscard]] AABB GetTransformedAABB(const mat4& transform) const override;
+  // only similarity transforms keep a sphere a sphere
+  [[nodiscard]] std::shared_ptr<Hittable> BakeTransform(const mat4& transform) const override;
+  [[nodiscard]] bool IsConvex() const override { return true; }
+  bool Span(const Ray& r, real& t_enter, real& t_exit) const override;
+  // uniform over the cone of directions the sphere subtends, or over the area from inside
+  bool SampleLight(const vec3& ref, vec2 u, real time, LightSample& sample) const override;
+  [[nodiscard]] real LightPDF(const vec3& ref, const vec3& point, real time) const override;
+  bool GetLightBounds(const Scene& scene, LightBounds& light_bounds) const override;
+  [[nodiscard]] uint32_t LightIndex() const override { return light_idx; }
+  // distance of the nearest hit in ray_t, without filling a hit record
+  bool Intersect(const Ray& r, Interval ray_t, real& t) const;
+  // fills rec for a hit at distance t along r
+  void SetHitRecord(const Scene& scene, const Ray& r, real t, HitRecord& rec) const;
   static vec2 GetUV(const vec3& p);
 };
 
+// Up to kWidth spheres as structure of arrays, so one SIMD kernel tests a ray against all of
+// them at once. Empty lanes have NaN centers, which never hit.
+struct alignas(16) SphereBlock {
+  static constexpr uint32_t kWidth = 4;
+  real center_x[kWidth], center_y[kWidth], center_z[kWidth];
+  // the center moves by this over the shutter
+  real displacement_x[kWidth], displacement_y[kWidth], displacement_z[kWidth];
+  real radius[kWidth];
+
+  SphereBlock();
+  void Set(uint32_t lane, const Sphere& sphere);
+  // lane of the nearest sphere hit within ray_t and its distance, -1 if there is none
+  [[nodiscard]] int NearestHit(const Ray& r, Interval ray_t, real& t) const;
+};
+
 }  // namespace raytrace2::cpu
 
 namespace raytrace2 {
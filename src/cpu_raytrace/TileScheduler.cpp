@@ -0,0 +1,122 @@
+#include "TileScheduler.hpp"
+
+namespace raytrace2::cpu {
+
+std::vector<Tile> MakeTiles(glm::ivec2 dims, int tile_size) {
+  EASSERT(tile_size > 0);
+  std::vector<Tile> tiles;
+  for (int y = 0; y < dims.y; y += tile_size) {
+    for (int x = 0; x < dims.x; x += tile_size) {
+      tiles.emplace_back(Tile{.min = {x, y},
+                              .max = {std::min(x + tile_size, dims.x),
+                                      std::min(y + tile_size, dims.y)}});
+    }
+  }
+  return tiles;
+}
+
+TileScheduler::TileScheduler(size_t num_workers) {
+  num_workers = std::max<size_t>(num_workers, 1);
+  queues_.reserve(num_workers);
+  for (size_t i = 0; i < num_workers; i++) {
+    queues_.emplace_back(std::make_unique<WorkerQueue>());
+  }
+  // worker 0 is the thread calling Run
+  threads_.reserve(num_workers - 1);
+  for (size_t i = 1; i < num_workers; i++) {
+    threads_.emplace_back([this, i]() { WorkerLoop(i); });
+  }
+}
+
+TileScheduler::~TileScheduler() {
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    shutdown_ = true;
+  }
+  start_cv_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+void TileScheduler::Run(std::span<const Tile> tiles, const TileFunc& func) {
+  if (tiles.empty()) return;
+  // hand each worker a contiguous run of tiles so it starts on its own region of the image
+  size_t num_workers = queues_.size();
+  size_t per_worker = (tiles.size() + num_workers - 1) / num_workers;
+  for (size_t w = 0; w < num_workers; w++) {
+    std::lock_guard<std::mutex> lock(queues_[w]->mtx);
+    size_t begin = std::min(w * per_worker, tiles.size());
+    size_t end = std::min(begin + per_worker, tiles.size());
+    for (size_t i = begin; i < end; i++) {
+      queues_[w]->tile_indices.push_back(static_cast<uint32_t>(i));
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    tiles_ = tiles;
+    func_ = &func;
+    active_workers_ = threads_.size();
+    generation_++;
+  }
+  start_cv_.notify_all();
+
+  Work(0);
+
+  std::unique_lock<std::mutex> lock(mtx_);
+  done_cv_.wait(lock, [this]() { return active_workers_ == 0; });
+  func_ = nullptr;
+}
+
+void TileScheduler::WorkerLoop(size_t worker_idx) {
+  uint64_t seen_generation = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mtx_);
+      start_cv_.wait(lock, [&]() { return shutdown_ || generation_ != seen_generation; });
+      if (shutdown_) return;
+      seen_generation = generation_;
+    }
+    Work(worker_idx);
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      if (--active_workers_ == 0) {
+        done_cv_.notify_one();
+      }
+    }
+  }
+}
+
+void TileScheduler::Work(size_t worker_idx) {
+  uint32_t tile_idx;
+  // tiles are only ever removed during a run, so once every queue is empty the worker is done
+  while (Pop(worker_idx, tile_idx) || Steal(worker_idx, tile_idx)) {
+    (*func_)(tile_idx, tiles_[tile_idx]);
+  }
+}
+
+bool TileScheduler::Pop(size_t worker_idx, uint32_t& tile_idx) {
+  WorkerQueue& queue = *queues_[worker_idx];
+  std::lock_guard<std::mutex> lock(queue.mtx);
+  if (queue.tile_indices.empty()) return false;
+  tile_idx = queue.tile_indices.front();
+  queue.tile_indices.pop_front();
+  return true;
+}
+
+bool TileScheduler::Steal(size_t thief_idx, uint32_t& tile_idx) {
+  size_t num_workers = queues_.size();
+  for (size_t i = 1; i < num_workers; i++) {
+    WorkerQueue& victim = *queues_[(thief_idx + i) % num_workers];
+    std::lock_guard<std::mutex> lock(victim.mtx);
+    if (victim.tile_indices.empty()) continue;
+    // take from the opposite end to the owner to stay out of its way
+    tile_idx = victim.tile_indices.back();
+    victim.tile_indices.pop_back();
+    return true;
+  }
+  return false;
+}
+
+}  // namespace raytrace2::cpu
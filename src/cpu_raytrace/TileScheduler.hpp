@@ -0,0 +1,61 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "Defs.hpp"
+
+namespace raytrace2::cpu {
+
+struct Tile {
+  // pixel bounds, max is exclusive
+  glm::ivec2 min;
+  glm::ivec2 max;
+};
+
+std::vector<Tile> MakeTiles(glm::ivec2 dims, int tile_size);
+
+// Persistent pool of workers that pull tiles from their own deque and steal from the back of
+// other workers' deques once theirs runs dry. The calling thread takes part as worker 0.
+class TileScheduler {
+ public:
+  // called with the index of the tile in the span passed to Run and the tile itself
+  using TileFunc = std::function<void(uint32_t, const Tile&)>;
+
+  explicit TileScheduler(size_t num_workers = std::thread::hardware_concurrency());
+  TileScheduler(const TileScheduler& other) = delete;
+  TileScheduler& operator=(const TileScheduler& other) = delete;
+  ~TileScheduler();
+
+  // blocks until func has been run on every tile
+  void Run(std::span<const Tile> tiles, const TileFunc& func);
+  [[nodiscard]] size_t NumWorkers() const { return queues_.size(); }
+
+ private:
+  struct alignas(64) WorkerQueue {
+    std::mutex mtx;
+    std::deque<uint32_t> tile_indices;
+  };
+
+  std::vector<std::unique_ptr<WorkerQueue>> queues_;
+  std::vector<std::thread> threads_;
+
+  std::mutex mtx_;
+  std::condition_variable start_cv_;
+  std::condition_variable done_cv_;
+  uint64_t generation_{0};
+  size_t active_workers_{0};
+  bool shutdown_{false};
+
+  std::span<const Tile> tiles_;
+  const TileFunc* func_{nullptr};
+
+  void WorkerLoop(size_t worker_idx);
+  void Work(size_t worker_idx);
+  bool Pop(size_t worker_idx, uint32_t& tile_idx);
+  bool Steal(size_t thief_idx, uint32_t& tile_idx);
+};
+
+}  // namespace raytrace2::cpu
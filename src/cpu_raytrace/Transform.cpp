@@ -13,10 +13,10 @@ namespace raytrace2::cpu {
 Ray TransformedHittable::WorldToModel(const Ray& r) const {
   // transform origin from world to model space
   vec3 transformed_origin = vec3(inv_model * vec4(r.origin, 1));
-  // transform direction to model space without translation component
-  vec3 transformed_dir = glm::normalize(mat3(inv_model) * r.direction);
+  // transform direction to model space without translation component. It is left unnormalized
+  // so t, and with it the ray interval, is the same in both spaces
+  vec3 transformed_dir = mat3(inv_model) * r.direction;
   return Ray{.origin = transformed_origin, .direction = transformed_dir, .time = r.time};
-  // return Ray{.origin = transformed_origin, .direction = r.direction, .time = r.time};
 }
 bool isIdentityMatrix(const glm::mat4& matrix, float epsilon = 1e-6f) {
   // Identity matrix for reference
@@ -39,28 +39,7 @@ void TransformedHittable::Init() {
 
   EASSERT(obj != nullptr);
 
-  // transform the existing aabb with model matrix
-  AABB existing_aabb = obj->GetAABB();
-  auto min = existing_aabb.GetMin();
-  auto max = existing_aabb.GetMax();
-  vec3 corners[8] = {
-      vec3(min.x, min.y, min.z), vec3(max.x, min.y, min.z), vec3(min.x, max.y, min.z),
-      vec3(max.x, max.y, min.z), vec3(min.x, min.y, max.z), vec3(max.x, min.y, max.z),
-      vec3(min.x, max.y, max.z), vec3(max.x, max.y, max.z),
-  };
-  vec3 new_min = vec3(kInfinity);
-  vec3 new_max = vec3(-kInfinity);
-  for (const vec3& corner : corners) {
-    vec3 transformed_corner = vec3(model * vec4(corner, 1.f));
-    new_min.x = std::fmin(new_min.x, transformed_corner.x);
-    new_min.y = std::fmin(new_min.y, transformed_corner.y);
-    new_min.z = std::fmin(new_min.z, transformed_corner.z);
-    new_max.x = std::fmax(new_max.x, transformed_corner.x);
-    new_max.y = std::fmax(new_max.y, transformed_corner.y);
-    new_max.z = std::fmax(new_max.z, transformed_corner.z);
-  }
-
-  aabb_ = AABB{new_min, new_max};
+  aabb_ = obj->GetTransformedAABB(model);
 }
 TransformedHittable::TransformedHittable(const std::shared_ptr<Hittable>& obj, mat4 transform)
     : model(transform), obj(obj) {
@@ -72,14 +51,16 @@ TransformedHittable::TransformedHittable(const std::shared_ptr<Hittable>& obj,
   Init();
 }
 
-bool TransformedHittable::Hit(const Scene& scene, const Ray& r, Interval ray_t,
+bool TransformedHittable::Hit(const Scene& scene, const Ray& r, Interval ray_t, RNG& rng,
                               HitRecord& rec) const {
   // transform ray to model space, hit object in model space, transform hit point and normal back to
   // world space
+  // cull against the world space bounds before paying for the matrix multiplies
+  if (!aabb_.Hit(TraversalRay{r}, ray_t)) return false;
 
   Ray model_space_ray = WorldToModel(r);
   EASSERT(obj != nullptr);
-  bool hit = obj->Hit(scene, model_space_ray, ray_t, rec);
+  bool hit = obj->Hit(scene, model_space_ray, ray_t, rng, rec);
   if (!hit) return false;
   // transform back to world space
   rec.point = vec3(model * vec4(rec.point, 1.f));
@@ -87,4 +68,11 @@ bool TransformedHittable::Hit(const Scene& scene, const Ray& r, Interval ray_t,
   return true;
 }
 
+bool TransformedHittable::Occluded(const Scene& scene, const Ray& r, Interval ray_t,
+                                   RNG& rng) const {
+  if (!aabb_.Hit(TraversalRay{r}, ray_t)) return false;
+  EASSERT(obj != nullptr);
+  return obj->Occluded(scene, WorldToModel(r), ray_t, rng);
+}
+
 }  // namespace raytrace2::cpu
@@ -25,8 +25,21 @@ struct TransformedHittable : public Hittable {
   mat3 normal_mat;
   std::shared_ptr<Hittable> obj;
 
-  bool Hit(const Scene& scene, const Ray& r, Interval ray_t, HitRecord& rec) const override;
+  bool Hit(const Scene& scene, const Ray& r, Interval ray_t, RNG& rng,
+           HitRecord& rec) const override;
+  bool Occluded(const Scene& scene, const Ray& r, Interval ray_t, RNG& rng) const override;
   [[nodiscard]] AABB GetAABB() const override { return aabb_; }
+  [[nodiscard]] AABB GetTransformedAABB(const mat4& transform) const override {
+    return obj->GetTransformedAABB(transform * model);
+  }
+  [[nodiscard]] std::shared_ptr<Hittable> BakeTransform(const mat4& transform) const override {
+    return obj->BakeTransform(transform * model);
+  }
+  // affine maps keep convex shapes convex, and t is the same in both spaces
+  [[nodiscard]] bool IsConvex() const override { return obj->IsConvex(); }
+  bool Span(const Ray& r, real& t_enter, real& t_exit) const override {
+    return obj->Span(WorldToModel(r), t_enter, t_exit);
+  }
   [[nodiscard]] Ray WorldToModel(const Ray& ray) const;
   [[nodiscard]] vec3 Apply(const vec3& point) const;
 
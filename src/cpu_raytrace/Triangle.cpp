@@ -0,0 +1,121 @@
+#include "Triangle.hpp"
+
+#if (defined(__SSE2__) || defined(_M_X64)) && !defined(DOUBLE)
+#include <immintrin.h>
+#define RAYTRACE2_SSE
+#endif
+
+#include <bit>
+#include <limits>
+
+namespace raytrace2::cpu {
+
+namespace {
+
+// Moller-Trumbore, solving for the distance and barycentrics with Cramer's rule. Rays parallel
+// to the triangle divide by a zero determinant, and the infinite or NaN barycentrics fail the
+// range tests, as do the NaN vertices of empty block lanes.
+[[maybe_unused]] bool IntersectTriangle(const vec3& v0, const vec3& edge1, const vec3& edge2,
+                                        const Ray& r, Interval ray_t, real& t,
+                                        vec2& barycentric) {
+  vec3 p = glm::cross(r.direction, edge2);
+  real inv_det = 1 / glm::dot(edge1, p);
+  vec3 s = r.origin - v0;
+  real b1 = glm::dot(s, p) * inv_det;
+  vec3 q = glm::cross(s, edge1);
+  real b2 = glm::dot(r.direction, q) * inv_det;
+  if (!(b1 >= 0 && b2 >= 0 && b1 + b2 <= 1)) return false;
+  real root = glm::dot(edge2, q) * inv_det;
+  if (!ray_t.Surrounds(root)) return false;
+  t = root;
+  barycentric = {b1, b2};
+  return true;
+}
+
+}  // namespace
+
+TriangleBlock::TriangleBlock() {
+  for (uint32_t i = 0; i < kWidth; i++) {
+    v0_x[i] = v0_y[i] = v0_z[i] = std::numeric_limits<real>::quiet_NaN();
+    edge1_x[i] = edge1_y[i] = edge1_z[i] = 0;
+    edge2_x[i] = edge2_y[i] = edge2_z[i] = 0;
+  }
+}
+
+void TriangleBlock::Set(uint32_t lane, const vec3& p0, const vec3& p1, const vec3& p2) {
+  vec3 edge1 = p1 - p0, edge2 = p2 - p0;
+  v0_x[lane] = p0.x;
+  v0_y[lane] = p0.y;
+  v0_z[lane] = p0.z;
+  edge1_x[lane] = edge1.x;
+  edge1_y[lane] = edge1.y;
+  edge1_z[lane] = edge1.z;
+  edge2_x[lane] = edge2.x;
+  edge2_y[lane] = edge2.y;
+  edge2_z[lane] = edge2.z;
+}
+
+// IntersectTriangle across the lanes
+int TriangleBlock::NearestHit(const Ray& r, Interval ray_t, real& t, vec2& barycentric) const {
+#ifdef RAYTRACE2_SSE
+  __m128 dir_x = _mm_set1_ps(r.direction.x);
+  __m128 dir_y = _mm_set1_ps(r.direction.y);
+  __m128 dir_z = _mm_set1_ps(r.direction.z);
+  __m128 e1_x = _mm_load_ps(edge1_x), e1_y = _mm_load_ps(edge1_y), e1_z = _mm_load_ps(edge1_z);
+  __m128 e2_x = _mm_load_ps(edge2_x), e2_y = _mm_load_ps(edge2_y), e2_z = _mm_load_ps(edge2_z);
+  auto dot = [](__m128 a_x, __m128 a_y, __m128 a_z, __m128 b_x, __m128 b_y, __m128 b_z) {
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a_x, b_x), _mm_mul_ps(a_y, b_y)),
+                      _mm_mul_ps(a_z, b_z));
+  };
+
+  // p = direction x edge2
+  __m128 p_x = _mm_sub_ps(_mm_mul_ps(dir_y, e2_z), _mm_mul_ps(dir_z, e2_y));
+  __m128 p_y = _mm_sub_ps(_mm_mul_ps(dir_z, e2_x), _mm_mul_ps(dir_x, e2_z));
+  __m128 p_z = _mm_sub_ps(_mm_mul_ps(dir_x, e2_y), _mm_mul_ps(dir_y, e2_x));
+  __m128 inv_det = _mm_div_ps(_mm_set1_ps(1), dot(e1_x, e1_y, e1_z, p_x, p_y, p_z));
+  __m128 s_x = _mm_sub_ps(_mm_set1_ps(r.origin.x), _mm_load_ps(v0_x));
+  __m128 s_y = _mm_sub_ps(_mm_set1_ps(r.origin.y), _mm_load_ps(v0_y));
+  __m128 s_z = _mm_sub_ps(_mm_set1_ps(r.origin.z), _mm_load_ps(v0_z));
+  __m128 b1 = _mm_mul_ps(dot(s_x, s_y, s_z, p_x, p_y, p_z), inv_det);
+  __m128 hit = _mm_cmpge_ps(b1, _mm_setzero_ps());
+  if (_mm_movemask_ps(hit) == 0) return -1;
+
+  // q = s x edge1
+  __m128 q_x = _mm_sub_ps(_mm_mul_ps(s_y, e1_z), _mm_mul_ps(s_z, e1_y));
+  __m128 q_y = _mm_sub_ps(_mm_mul_ps(s_z, e1_x), _mm_mul_ps(s_x, e1_z));
+  __m128 q_z = _mm_sub_ps(_mm_mul_ps(s_x, e1_y), _mm_mul_ps(s_y, e1_x));
+  __m128 b2 = _mm_mul_ps(dot(dir_x, dir_y, dir_z, q_x, q_y, q_z), inv_det);
+  __m128 root = _mm_mul_ps(dot(e2_x, e2_y, e2_z, q_x, q_y, q_z), inv_det);
+  hit = _mm_and_ps(hit, _mm_cmpge_ps(b2, _mm_setzero_ps()));
+  hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(b1, b2), _mm_set1_ps(1)));
+  hit = _mm_and_ps(hit, _mm_cmpgt_ps(root, _mm_set1_ps(ray_t.min)));
+  hit = _mm_and_ps(hit, _mm_cmplt_ps(root, _mm_set1_ps(ray_t.max)));
+  int hit_mask = _mm_movemask_ps(hit);
+  if (hit_mask == 0) return -1;
+
+  root = _mm_or_ps(_mm_and_ps(hit, root), _mm_andnot_ps(hit, _mm_set1_ps(kInfinity)));
+  // smallest root in every lane, then the first lane holding it
+  __m128 nearest = _mm_min_ps(root, _mm_shuffle_ps(root, root, _MM_SHUFFLE(2, 3, 0, 1)));
+  nearest = _mm_min_ps(nearest, _mm_shuffle_ps(nearest, nearest, _MM_SHUFFLE(1, 0, 3, 2)));
+  int lane = std::countr_zero(
+      static_cast<unsigned>(_mm_movemask_ps(_mm_cmpeq_ps(root, nearest)) & hit_mask));
+  alignas(16) float lane_b1[kWidth], lane_b2[kWidth];
+  _mm_store_ps(lane_b1, b1);
+  _mm_store_ps(lane_b2, b2);
+  t = _mm_cvtss_f32(nearest);
+  barycentric = {lane_b1[lane], lane_b2[lane]};
+  return lane;
+#else
+  int nearest = -1;
+  for (uint32_t i = 0; i < kWidth; i++) {
+    if (IntersectTriangle({v0_x[i], v0_y[i], v0_z[i]}, {edge1_x[i], edge1_y[i], edge1_z[i]},
+                          {edge2_x[i], edge2_y[i], edge2_z[i]}, r, ray_t, t, barycentric)) {
+      nearest = static_cast<int>(i);
+      ray_t.max = t;
+    }
+  }
+  return nearest;
+#endif
+}
+
+}  // namespace raytrace2::cpu
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "Defs.hpp"
+#include "cpu_raytrace/Interval.hpp"
+#include "cpu_raytrace/Ray.hpp"
+
+namespace raytrace2::cpu {
+
+// Vertex arrays of a triangle mesh and three indices into them per triangle. Normals and uvs are
+// optional and indexed separately, as OBJ files do, so they are empty or hold one index per
+// position index.
+struct MeshData {
+  std::vector<vec3> positions;
+  std::vector<uint32_t> indices;
+  std::vector<vec3> normals;
+  std::vector<uint32_t> normal_indices;
+  std::vector<vec2> uvs;
+  std::vector<uint32_t> uv_indices;
+
+  [[nodiscard]] size_t NumTriangles() const { return indices.size() / 3; }
+  [[nodiscard]] const vec3& Position(size_t triangle, int corner) const {
+    return positions[indices[3 * triangle + corner]];
+  }
+};
+
+// Up to kWidth triangles as structure of arrays, so one SIMD kernel tests a ray against all of
+// them at once. Empty lanes have NaN vertices, which never hit.
+struct alignas(16) TriangleBlock {
+  static constexpr uint32_t kWidth = 4;
+  real v0_x[kWidth], v0_y[kWidth], v0_z[kWidth];
+  real edge1_x[kWidth], edge1_y[kWidth], edge1_z[kWidth];
+  real edge2_x[kWidth], edge2_y[kWidth], edge2_z[kWidth];
+
+  TriangleBlock();
+  void Set(uint32_t lane, const vec3& p0, const vec3& p1, const vec3& p2);
+  // lane of the nearest triangle hit within ray_t, its distance and the barycentric coordinates
+  // of the hit point with respect to the second and third vertex, -1 if there is none
+  [[nodiscard]] int NearestHit(const Ray& r, Interval ray_t, real& t, vec2& barycentric) const;
+};
+
+}  // namespace raytrace2::cpu
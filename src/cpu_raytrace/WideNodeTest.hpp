@@ -0,0 +1,81 @@
+#pragma once
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define RAYTRACE2_SSE
+#endif
+
+#include "cpu_raytrace/BVH.hpp"
+#include "cpu_raytrace/Ray.hpp"
+
+// Slab test of a WideBVHNode, internal to BVH.cpp and split out so tools/bench times the same
+// kernel. Not included by BVH.hpp, which would leak RAYTRACE2_SSE into every file using it.
+namespace raytrace2::cpu::detail {
+
+// traversal ray with the origin and reciprocal direction splatted across the SIMD lanes
+struct WideTraversalRay {
+  explicit WideTraversalRay(const TraversalRay& tr)
+      : tr(tr)
+#ifdef RAYTRACE2_SSE
+        ,
+        org_x(_mm_set1_ps(static_cast<float>(tr.origin.x))),
+        org_y(_mm_set1_ps(static_cast<float>(tr.origin.y))),
+        org_z(_mm_set1_ps(static_cast<float>(tr.origin.z))),
+        inv_x(_mm_set1_ps(static_cast<float>(tr.inv_dir.x))),
+        inv_y(_mm_set1_ps(static_cast<float>(tr.inv_dir.y))),
+        inv_z(_mm_set1_ps(static_cast<float>(tr.inv_dir.z)))
+#endif
+  {
+  }
+
+  const TraversalRay& tr;
+#ifdef RAYTRACE2_SSE
+  __m128 org_x, org_y, org_z;
+  __m128 inv_x, inv_y, inv_z;
+#endif
+};
+
+// slab tests the ray against all children of the node, returns a bit mask of the children hit
+// and writes their entry distances to t_near, which must be 16 byte aligned
+inline int IntersectChildren(const WideBVHNode& node, const WideTraversalRay& wr,
+                             Interval ray_t, float* t_near) {
+  const TraversalRay& tr = wr.tr;
+  // the near plane of each slab is the max bound when the direction is negative
+  const float* near_x = tr.dir_is_neg[0] ? node.max_x : node.min_x;
+  const float* far_x = tr.dir_is_neg[0] ? node.min_x : node.max_x;
+  const float* near_y = tr.dir_is_neg[1] ? node.max_y : node.min_y;
+  const float* far_y = tr.dir_is_neg[1] ? node.min_y : node.max_y;
+  const float* near_z = tr.dir_is_neg[2] ? node.max_z : node.min_z;
+  const float* far_z = tr.dir_is_neg[2] ? node.min_z : node.max_z;
+#ifdef RAYTRACE2_SSE
+  // max/min return their second operand on NaN, keeping the ray interval in that position
+  __m128 t_min = _mm_set1_ps(static_cast<float>(ray_t.min));
+  __m128 t_max = _mm_set1_ps(static_cast<float>(ray_t.max));
+  t_min = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(near_x), wr.org_x), wr.inv_x), t_min);
+  t_min = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(near_y), wr.org_y), wr.inv_y), t_min);
+  t_min = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(near_z), wr.org_z), wr.inv_z), t_min);
+  t_max = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(far_x), wr.org_x), wr.inv_x), t_max);
+  t_max = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(far_y), wr.org_y), wr.inv_y), t_max);
+  t_max = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(far_z), wr.org_z), wr.inv_z), t_max);
+  _mm_store_ps(t_near, t_min);
+  return _mm_movemask_ps(_mm_cmple_ps(t_min, t_max));
+#else
+  int hit_mask = 0;
+  for (uint32_t i = 0; i < WideBVHNode::kWidth; i++) {
+    // std::max/min return their first argument on NaN, so the ray interval goes first as in
+    // AABB::Hit
+    real t0 = ray_t.min, t1 = ray_t.max;
+    t0 = std::max(t0, (near_x[i] - tr.origin.x) * tr.inv_dir.x);
+    t0 = std::max(t0, (near_y[i] - tr.origin.y) * tr.inv_dir.y);
+    t0 = std::max(t0, (near_z[i] - tr.origin.z) * tr.inv_dir.z);
+    t1 = std::min(t1, (far_x[i] - tr.origin.x) * tr.inv_dir.x);
+    t1 = std::min(t1, (far_y[i] - tr.origin.y) * tr.inv_dir.y);
+    t1 = std::min(t1, (far_z[i] - tr.origin.z) * tr.inv_dir.z);
+    t_near[i] = static_cast<float>(t0);
+    hit_mask |= static_cast<int>(t0 <= t1) << i;
+  }
+  return hit_mask;
+#endif
+}
+
+}  // namespace raytrace2::cpu::detail
@@ -0,0 +1,203 @@
+// Times the box slab tests before and after precomputing the traversal ray, on random boxes
+// and rays. The "old" kernels are copies of AABB::Hit and the 4-wide node test as they were
+// before TraversalRay, the "new" ones are the AABB::Hit(TraversalRay) and IntersectChildren
+// the BVH uses.
+//
+// usage: slab_bench [num_rays] [repeats]
+
+#include <bit>
+#include <chrono>
+#include <cstdio>
+#include <limits>
+#include <random>
+
+#include "cpu_raytrace/AABB.hpp"
+#include "cpu_raytrace/BVH.hpp"
+#include "cpu_raytrace/Ray.hpp"
+#include "cpu_raytrace/WideNodeTest.hpp"
+
+using namespace raytrace2::cpu;
+
+namespace {
+
+constexpr size_t kNumBoxes = 1024;
+// boxes each ray is tested against, about what a traversal of a mid sized scene visits
+constexpr size_t kBoxesPerRay = 64;
+constexpr size_t kNodesPerRay = kBoxesPerRay / WideBVHNode::kWidth;
+
+bool OldAABBHit(const AABB& box, const Ray& r, Interval ray_t) {
+  for (int axis = 0; axis < 3; axis++) {
+    const Interval& ax = box.AxisInterval(axis);
+    const real ad_inv = 1.f / r.direction[axis];
+    auto t0 = (ax.min - r.origin[axis]) * ad_inv;
+    auto t1 = (ax.max - r.origin[axis]) * ad_inv;
+    if (t1 < t0) std::swap(t0, t1);
+    ray_t.min = glm::max(t0, ray_t.min);
+    ray_t.max = glm::min(t1, ray_t.max);
+    if (ray_t.max < ray_t.min) return false;
+  }
+  return true;
+}
+
+// the node test inlined in BVH::HitWide, with the ray set up once per query
+struct OldWideRay {
+  explicit OldWideRay(const Ray& r)
+      : r(r),
+        inv_dir(static_cast<real>(1) / r.direction),
+        dir_is_neg{r.direction.x < 0, r.direction.y < 0, r.direction.z < 0}
+#ifdef RAYTRACE2_SSE
+        ,
+        org_x(_mm_set1_ps(static_cast<float>(r.origin.x))),
+        org_y(_mm_set1_ps(static_cast<float>(r.origin.y))),
+        org_z(_mm_set1_ps(static_cast<float>(r.origin.z))),
+        inv_x(_mm_set1_ps(static_cast<float>(inv_dir.x))),
+        inv_y(_mm_set1_ps(static_cast<float>(inv_dir.y))),
+        inv_z(_mm_set1_ps(static_cast<float>(inv_dir.z)))
+#endif
+  {
+  }
+
+  const Ray& r;
+  vec3 inv_dir;
+  bool dir_is_neg[3];
+#ifdef RAYTRACE2_SSE
+  __m128 org_x, org_y, org_z;
+  __m128 inv_x, inv_y, inv_z;
+#endif
+};
+
+int OldIntersectChildren(const WideBVHNode& node, const OldWideRay& wr, Interval ray_t,
+                         float* t_near) {
+  const float* near_x = wr.dir_is_neg[0] ? node.max_x : node.min_x;
+  const float* far_x = wr.dir_is_neg[0] ? node.min_x : node.max_x;
+  const float* near_y = wr.dir_is_neg[1] ? node.max_y : node.min_y;
+  const float* far_y = wr.dir_is_neg[1] ? node.min_y : node.max_y;
+  const float* near_z = wr.dir_is_neg[2] ? node.max_z : node.min_z;
+  const float* far_z = wr.dir_is_neg[2] ? node.min_z : node.max_z;
+#ifdef RAYTRACE2_SSE
+  __m128 t_min = _mm_set1_ps(static_cast<float>(ray_t.min));
+  __m128 t_max = _mm_set1_ps(static_cast<float>(ray_t.max));
+  t_min = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(near_x), wr.org_x), wr.inv_x), t_min);
+  t_min = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(near_y), wr.org_y), wr.inv_y), t_min);
+  t_min = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(near_z), wr.org_z), wr.inv_z), t_min);
+  t_max = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(far_x), wr.org_x), wr.inv_x), t_max);
+  t_max = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(far_y), wr.org_y), wr.inv_y), t_max);
+  t_max = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(far_z), wr.org_z), wr.inv_z), t_max);
+  _mm_store_ps(t_near, t_min);
+  return _mm_movemask_ps(_mm_cmple_ps(t_min, t_max));
+#else
+  const Ray& r = wr.r;
+  int hit_mask = 0;
+  for (uint32_t i = 0; i < WideBVHNode::kWidth; i++) {
+    real t0 = ray_t.min, t1 = ray_t.max;
+    t0 = std::max((near_x[i] - r.origin.x) * wr.inv_dir.x, t0);
+    t0 = std::max((near_y[i] - r.origin.y) * wr.inv_dir.y, t0);
+    t0 = std::max((near_z[i] - r.origin.z) * wr.inv_dir.z, t0);
+    t1 = std::min((far_x[i] - r.origin.x) * wr.inv_dir.x, t1);
+    t1 = std::min((far_y[i] - r.origin.y) * wr.inv_dir.y, t1);
+    t1 = std::min((far_z[i] - r.origin.z) * wr.inv_dir.z, t1);
+    t_near[i] = static_cast<float>(t0);
+    hit_mask |= static_cast<int>(t0 <= t1) << i;
+  }
+  return hit_mask;
+#endif
+}
+
+// runs f over every ray repeats times and returns the best time in nanoseconds per ray, along
+// with the hits counted so the work can't be optimized away
+template <typename F>
+double Time(const char* name, const std::vector<Ray>& rays, int repeats, F&& f) {
+  double best = std::numeric_limits<double>::max();
+  size_t hits = 0;
+  for (int rep = 0; rep < repeats; rep++) {
+    hits = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < rays.size(); i++) hits += f(rays[i], i);
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    best = std::min(best, elapsed.count() / static_cast<double>(rays.size()));
+  }
+  std::printf("%-28s %8.2f ns/ray  %zu hits\n", name, best, hits);
+  return best;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  size_t num_rays = argc > 1 ? std::stoul(argv[1]) : 1 << 20;
+  int repeats = argc > 2 ? std::stoi(argv[2]) : 5;
+
+  std::mt19937 gen(1234);
+  std::uniform_real_distribution<real> pos(-10, 10);
+  std::uniform_real_distribution<real> size(0.1f, 3);
+  std::uniform_real_distribution<real> unit(-1, 1);
+
+  std::vector<AABB> boxes;
+  boxes.reserve(kNumBoxes);
+  for (size_t i = 0; i < kNumBoxes; i++) {
+    vec3 min{pos(gen), pos(gen), pos(gen)};
+    boxes.emplace_back(min, min + vec3{size(gen), size(gen), size(gen)});
+  }
+  // one in eight rays is axis aligned, which is common for quads and boxes and gives the slab
+  // tests their infinite reciprocals
+  std::vector<Ray> rays(num_rays);
+  for (size_t i = 0; i < num_rays; i++) {
+    vec3 dir{unit(gen), unit(gen), unit(gen)};
+    if (i % 8 == 0) dir = vec3{0, 0, dir.z < 0 ? -1 : 1};
+    rays[i] = Ray{{pos(gen), pos(gen), pos(gen)}, dir, 0};
+  }
+
+  std::vector<WideBVHNode> nodes(kNumBoxes / WideBVHNode::kWidth);
+  for (size_t n = 0; n < nodes.size(); n++) {
+    for (uint32_t i = 0; i < WideBVHNode::kWidth; i++) {
+      const AABB& box = boxes[n * WideBVHNode::kWidth + i];
+      nodes[n].min_x[i] = static_cast<float>(box.x.min);
+      nodes[n].min_y[i] = static_cast<float>(box.y.min);
+      nodes[n].min_z[i] = static_cast<float>(box.z.min);
+      nodes[n].max_x[i] = static_cast<float>(box.x.max);
+      nodes[n].max_y[i] = static_cast<float>(box.y.max);
+      nodes[n].max_z[i] = static_cast<float>(box.z.max);
+    }
+  }
+
+  // each ray tests a window of consecutive boxes or nodes, like a traversal would
+  const Interval ray_t{0, kInfinity};
+  auto box_offset = [&](size_t i) { return (i * 7) % (kNumBoxes - kBoxesPerRay); };
+  auto node_offset = [&](size_t i) { return (i * 7) % (nodes.size() - kNodesPerRay); };
+
+  std::printf("%zu rays, %zu boxes per ray, best of %d\n", num_rays, kBoxesPerRay, repeats);
+  double old_box = Time("AABB::Hit old", rays, repeats, [&](const Ray& r, size_t i) {
+    size_t hits = 0, first = box_offset(i);
+    for (size_t b = first; b < first + kBoxesPerRay; b++) hits += OldAABBHit(boxes[b], r, ray_t);
+    return hits;
+  });
+  double new_box = Time("AABB::Hit(TraversalRay)", rays, repeats, [&](const Ray& r, size_t i) {
+    size_t hits = 0, first = box_offset(i);
+    const TraversalRay tr{r};
+    for (size_t b = first; b < first + kBoxesPerRay; b++) hits += boxes[b].Hit(tr, ray_t);
+    return hits;
+  });
+  double old_wide = Time("wide node test old", rays, repeats, [&](const Ray& r, size_t i) {
+    size_t hits = 0, first = node_offset(i);
+    const OldWideRay wr{r};
+    alignas(16) float t_near[WideBVHNode::kWidth];
+    for (size_t n = first; n < first + kNodesPerRay; n++) {
+      hits += std::popcount(static_cast<unsigned>(OldIntersectChildren(nodes[n], wr, ray_t,
+                                                                       t_near)));
+    }
+    return hits;
+  });
+  double new_wide = Time("IntersectChildren", rays, repeats, [&](const Ray& r, size_t i) {
+    size_t hits = 0, first = node_offset(i);
+    const TraversalRay tr{r};
+    const detail::WideTraversalRay wr{tr};
+    alignas(16) float t_near[WideBVHNode::kWidth];
+    for (size_t n = first; n < first + kNodesPerRay; n++) {
+      hits += std::popcount(
+          static_cast<unsigned>(detail::IntersectChildren(nodes[n], wr, ray_t, t_near)));
+    }
+    return hits;
+  });
+  std::printf("AABB::Hit speedup %.2fx, wide node test speedup %.2fx\n", old_box / new_box,
+              old_wide / new_wide);
+  return 0;
+}